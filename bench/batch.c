@@ -0,0 +1,89 @@
+#include "jc.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+
+/*
+ * Compares tokenizing many small documents with a loop of `jc_init` and
+ * `jc_next_token` against `jc_tokenize_batch`. Both take about the same time:
+ * initializing a state is a few stores against scanning dozens of tokens.
+ */
+
+#define NUM_DOCUMENTS 10000
+#define BATCH_SIZE 64
+#define MAX_TOKENS_PER_DOCUMENT 64
+#define NUM_ROUNDS 100
+#define DOCUMENT_TEMPLATE \
+    "{\"id\": %d, \"method\": \"user.get\", \"params\": {\"user_id\": %d, " \
+    "\"fields\": [\"name\", \"email\", \"created_at\"], \"verbose\": false}, " \
+    "\"trace\": \"%08x\", \"deadline_ms\": 250}"
+
+double seconds_since(clock_t start)
+{
+    return (double) (clock() - start) / CLOCKS_PER_SEC;
+}
+
+void report(char const * name, double seconds, size_t num_bytes,
+            size_t num_tokens)
+{
+    printf("%-24s %8.3f s %10.1f MB/s %10.2f Mdocs/s (%lu tokens)\n", name,
+            seconds, num_bytes / seconds / 1e6,
+            (double) NUM_DOCUMENTS * NUM_ROUNDS / seconds / 1e6,
+            (unsigned long) num_tokens);
+}
+
+int main()
+{
+    static char sources[NUM_DOCUMENTS][256];
+    static jc_document documents[NUM_DOCUMENTS];
+    static jc_token tokens[BATCH_SIZE * MAX_TOKENS_PER_DOCUMENT];
+    jc_document_tokens ranges[BATCH_SIZE];
+    jc_state state;
+    jc_token token;
+    size_t num_bytes = 0;
+    size_t num_tokens = 0;
+    size_t num_processed = 0;
+    size_t round = 0;
+    size_t i = 0;
+    size_t j = 0;
+    clock_t start;
+
+    for (i = 0; i < NUM_DOCUMENTS; ++i) {
+        sprintf(sources[i], DOCUMENT_TEMPLATE, (int) i, (int) (i * 7919),
+                (unsigned int) (i * 2654435761u));
+        documents[i].source = sources[i];
+        documents[i].len = strlen(sources[i]);
+        num_bytes += documents[i].len;
+    }
+    num_bytes *= NUM_ROUNDS;
+
+    start = clock();
+    for (round = 0; round < NUM_ROUNDS; ++round) {
+        for (i = 0; i < NUM_DOCUMENTS; ++i) {
+            jc_init(&state, sources[i]);
+            while (jc_next_token(&state, &token) == JC_RESULT_OK) {
+                tokens[num_tokens % BATCH_SIZE] = token;
+                ++num_tokens;
+            }
+        }
+    }
+    report("jc_init + jc_next_token", seconds_since(start), num_bytes,
+           num_tokens);
+
+    num_tokens = 0;
+    start = clock();
+    for (round = 0; round < NUM_ROUNDS; ++round) {
+        for (i = 0; i < NUM_DOCUMENTS; i += num_processed) {
+            num_processed = jc_tokenize_batch(
+                documents + i,
+                (NUM_DOCUMENTS - i < BATCH_SIZE) ? NUM_DOCUMENTS - i : BATCH_SIZE,
+                tokens, sizeof(tokens) / sizeof(*tokens), ranges);
+            for (j = 0; j < num_processed; ++j) {
+                num_tokens += ranges[j].num_tokens;
+            }
+        }
+    }
+    report("jc_tokenize_batch", seconds_since(start), num_bytes, num_tokens);
+
+    return 0;
+}
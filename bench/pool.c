@@ -0,0 +1,290 @@
+#define _GNU_SOURCE
+#include "jc.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+ * A fixed-size worker pool that validates and tokenizes submitted documents,
+ * and a benchmark of its throughput and latency percentiles for a growing
+ * number of workers, with and without pinning workers to cores.
+ *
+ * Every worker owns a single-producer single-consumer lock-free ring of jobs,
+ * a jc_state and a token buffer that are reused for every job. The submitting
+ * thread distributes jobs round-robin, skipping full rings. A finished job is
+ * reported both by its callback, called from the worker thread, and by its
+ * `done` flag, which can be polled like a future.
+ */
+
+#define POOL_MAX_WORKERS 64
+#define POOL_RING_SIZE 1024
+#define POOL_MAX_TOKENS 256
+
+#define NUM_JOBS 200000
+#define NUM_SOURCES 1024
+#define DOCUMENT_TEMPLATE \
+    "{\"id\": %d, \"method\": \"order.create\", \"params\": {\"items\": " \
+    "[%d, %d, %d], \"note\": \"%.*s\"}, \"valid\": %s}"
+
+typedef struct pool_job_s pool_job;
+
+typedef void (*pool_callback)(pool_job * job);
+
+struct pool_job_s {
+    jc_document document;
+    pool_callback callback;
+    void * ctx;
+    jc_result result;
+    size_t num_tokens;
+    int done;
+};
+
+typedef struct {
+    pool_job * jobs[POOL_RING_SIZE];
+    size_t head;
+    size_t tail;
+} pool_ring;
+
+typedef struct {
+    pool_ring ring;
+    pthread_t thread;
+    int cpu;
+    int * stop;
+    jc_state state;
+    jc_token tokens[POOL_MAX_TOKENS];
+} pool_worker;
+
+typedef struct {
+    pool_worker workers[POOL_MAX_WORKERS];
+    size_t num_workers;
+    size_t next_worker;
+    int stop;
+} pool;
+
+int pool_ring_push(pool_ring * ring, pool_job * job)
+{
+    size_t tail = ring->tail;
+    if (tail - __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE)
+            == POOL_RING_SIZE) {
+        return 0;
+    }
+
+    ring->jobs[tail % POOL_RING_SIZE] = job;
+    __atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+    return 1;
+}
+
+pool_job * pool_ring_pop(pool_ring * ring)
+{
+    size_t head = ring->head;
+    pool_job * job = NULL;
+
+    if (head == __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE)) {
+        return NULL;
+    }
+
+    job = ring->jobs[head % POOL_RING_SIZE];
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+    return job;
+}
+
+void * pool_worker_run(void * arg)
+{
+    pool_worker * worker = arg;
+    pool_job * job = NULL;
+    cpu_set_t cpus;
+
+    if (worker->cpu >= 0) {
+        CPU_ZERO(&cpus);
+        CPU_SET(worker->cpu, &cpus);
+        pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+    }
+
+    while (!__atomic_load_n(worker->stop, __ATOMIC_ACQUIRE)) {
+        job = pool_ring_pop(&worker->ring);
+        if (job == NULL) {
+            sched_yield();
+            continue;
+        }
+
+        job->result = jc_init_n(&worker->state, job->document.source,
+                                job->document.len);
+        if (job->result == JC_RESULT_OK) {
+            job->result = jc_tokenize(&worker->state, worker->tokens,
+                                      POOL_MAX_TOKENS, &job->num_tokens);
+        }
+
+        if (job->callback != NULL) {
+            job->callback(job);
+        }
+        __atomic_store_n(&job->done, 1, __ATOMIC_RELEASE);
+    }
+
+    return NULL;
+}
+
+/*
+ * Starts `num_workers` workers; if `pin` is set, worker N is pinned to core
+ * N modulo the number of online cores.
+ */
+int pool_start(pool * p, size_t num_workers, int pin)
+{
+    long num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t i = 0;
+
+    if (num_workers == 0 || num_workers > POOL_MAX_WORKERS) {
+        return 0;
+    }
+
+    p->num_workers = num_workers;
+    p->next_worker = 0;
+    p->stop = 0;
+    for (i = 0; i < num_workers; ++i) {
+        p->workers[i].ring.head = 0;
+        p->workers[i].ring.tail = 0;
+        p->workers[i].stop = &p->stop;
+        p->workers[i].cpu = (pin && num_cpus > 0) ? (int) (i % num_cpus) : -1;
+        if (pthread_create(&p->workers[i].thread, NULL, pool_worker_run,
+                           &p->workers[i]) != 0) {
+            p->num_workers = i;
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+void pool_submit(pool * p, pool_job * job)
+{
+    size_t attempts = 0;
+
+    job->done = 0;
+    while (!pool_ring_push(&p->workers[p->next_worker].ring, job)) {
+        p->next_worker = (p->next_worker + 1) % p->num_workers;
+        if (++attempts % p->num_workers == 0) {
+            sched_yield();
+        }
+    }
+    p->next_worker = (p->next_worker + 1) % p->num_workers;
+}
+
+void pool_stop(pool * p)
+{
+    size_t i = 0;
+
+    __atomic_store_n(&p->stop, 1, __ATOMIC_RELEASE);
+    for (i = 0; i < p->num_workers; ++i) {
+        pthread_join(p->workers[i].thread, NULL);
+    }
+}
+
+/* --- Benchmark --- */
+
+typedef struct {
+    struct timespec submitted;
+    double latency_us;
+} job_timing;
+
+double elapsed_us(struct timespec const * from, struct timespec const * to)
+{
+    return (to->tv_sec - from->tv_sec) * 1e6
+         + (to->tv_nsec - from->tv_nsec) / 1e3;
+}
+
+void record_latency(pool_job * job)
+{
+    job_timing * timing = job->ctx;
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    timing->latency_us = elapsed_us(&timing->submitted, &now);
+}
+
+int compare_doubles(void const * a, void const * b)
+{
+    double x = *(double const *) a;
+    double y = *(double const *) b;
+    return (x > y) - (x < y);
+}
+
+void run(pool_job * jobs, job_timing * timings, double * latencies,
+         size_t num_workers, int pin)
+{
+    static pool p;
+    struct timespec start;
+    struct timespec end;
+    size_t num_invalid = 0;
+    size_t i = 0;
+
+    if (!pool_start(&p, num_workers, pin)) {
+        fprintf(stderr, "Can't start %lu workers\n",
+                (unsigned long) num_workers);
+        exit(1);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < NUM_JOBS; ++i) {
+        clock_gettime(CLOCK_MONOTONIC, &timings[i].submitted);
+        pool_submit(&p, &jobs[i]);
+    }
+    for (i = 0; i < NUM_JOBS; ++i) {
+        while (!__atomic_load_n(&jobs[i].done, __ATOMIC_ACQUIRE)) {
+            sched_yield();
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    pool_stop(&p);
+
+    for (i = 0; i < NUM_JOBS; ++i) {
+        latencies[i] = timings[i].latency_us;
+        num_invalid += jobs[i].result != JC_RESULT_OK;
+    }
+    qsort(latencies, NUM_JOBS, sizeof(*latencies), compare_doubles);
+
+    printf("%7lu %6s %12.2f %10.1f %10.1f %10.1f %10.1f %8lu\n",
+            (unsigned long) num_workers, pin ? "yes" : "no",
+            NUM_JOBS / elapsed_us(&start, &end),
+            latencies[NUM_JOBS / 2], latencies[NUM_JOBS * 9 / 10],
+            latencies[NUM_JOBS * 99 / 100], latencies[NUM_JOBS - 1],
+            (unsigned long) num_invalid);
+}
+
+int main()
+{
+    static char sources[NUM_SOURCES][256];
+    static pool_job jobs[NUM_JOBS];
+    static job_timing timings[NUM_JOBS];
+    static double latencies[NUM_JOBS];
+    long num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t max_workers = (num_cpus > 2) ? (size_t) num_cpus * 2 : 4;
+    size_t num_workers = 0;
+    size_t i = 0;
+
+    for (i = 0; i < NUM_SOURCES; ++i) {
+        sprintf(sources[i], DOCUMENT_TEMPLATE, (int) i, (int) i * 3,
+                (int) i * 5, (int) i * 7, (int) (i % 64),
+                "................................................................",
+                (i % 100 == 0) ? "tru" : "true");
+    }
+    for (i = 0; i < NUM_JOBS; ++i) {
+        jobs[i].document.source = sources[i % NUM_SOURCES];
+        jobs[i].document.len = strlen(sources[i % NUM_SOURCES]);
+        jobs[i].callback = record_latency;
+        jobs[i].ctx = &timings[i];
+    }
+
+    printf("%lu jobs, %ld online cores; latencies in microseconds\n",
+            (unsigned long) NUM_JOBS, num_cpus);
+    printf("%7s %6s %12s %10s %10s %10s %10s %8s\n", "workers", "pinned",
+            "Mjobs/s", "p50", "p90", "p99", "max", "invalid");
+    for (num_workers = 1; num_workers <= max_workers
+            && num_workers <= POOL_MAX_WORKERS; num_workers *= 2) {
+        run(jobs, timings, latencies, num_workers, 0);
+        run(jobs, timings, latencies, num_workers, 1);
+    }
+
+    return 0;
+}
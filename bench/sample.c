@@ -0,0 +1,72 @@
+#include "jc.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+
+/*
+ * Measures NDJSON sampling throughput for a growing skip ratio, compared to
+ * tokenizing every record.
+ */
+
+#define NUM_RECORDS 200000
+#define RECORD_TEMPLATE \
+    "{\"ts\": %d, \"level\": \"info\", \"service\": \"billing\", " \
+    "\"msg\": \"charged customer %d\", \"ctx\": {\"amount\": %d.%02d, " \
+    "\"currency\": \"EUR\", \"tags\": [\"a\", \"b\", \"c\"]}}\n"
+
+double run(jc_sampler * sampler, size_t num_bytes, char const * name)
+{
+    jc_state state;
+    jc_token token;
+    size_t num_selected = 0;
+    size_t num_tokens = 0;
+    clock_t start = clock();
+    double seconds = 0;
+
+    while (jc_sampler_next(sampler, &state, NULL) == JC_RESULT_OK) {
+        ++num_selected;
+        while (jc_next_token(&state, &token) == JC_RESULT_OK) {
+            ++num_tokens;
+        }
+    }
+
+    seconds = (double) (clock() - start) / CLOCKS_PER_SEC;
+    printf("%-16s %8lu records %10lu tokens %10.1f MB/s\n", name,
+            (unsigned long) num_selected, (unsigned long) num_tokens,
+            num_bytes / seconds / 1e6);
+    return seconds;
+}
+
+int main()
+{
+    static char record[512];
+    char * source = NULL;
+    size_t len = 0;
+    size_t k = 0;
+    size_t i = 0;
+    char name[32];
+    jc_sampler sampler;
+
+    source = malloc(NUM_RECORDS * sizeof(record));
+    if (source == NULL) {
+        return 1;
+    }
+    for (i = 0; i < NUM_RECORDS; ++i) {
+        sprintf(record, RECORD_TEMPLATE, (int) i, (int) (i * 31), (int) i % 977,
+                (int) i % 100);
+        strcpy(source + len, record);
+        len += strlen(record);
+    }
+
+    for (k = 1; k <= 256; k *= 4) {
+        sprintf(name, "every %lu", (unsigned long) k);
+        jc_sampler_init_every(&sampler, source, len, k);
+        run(&sampler, len, name);
+    }
+
+    jc_sampler_init_fraction(&sampler, source, len, 0.01, 42);
+    run(&sampler, len, "fraction 1%");
+
+    free(source);
+    return 0;
+}
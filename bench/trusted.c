@@ -0,0 +1,74 @@
+#include "jc.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+
+/*
+ * Measures tokenizing throughput of valid JSON with and without trusted input
+ * mode.
+ */
+
+#define NUM_RECORDS 200000
+#define NUM_RUNS 5
+#define RECORD_TEMPLATE \
+    "{\"id\": %d, \"name\": \"customer %d\", \"active\": %s, " \
+    "\"balance\": %d.%02d, \"tags\": [\"a\", \"b\", null], " \
+    "\"address\": {\"city\": \"Berlin\", \"zip\": \"%05d\"}}"
+
+double run(char const * source, size_t len, int trusted)
+{
+    jc_state state;
+    jc_token token;
+    jc_result result = JC_RESULT_OK;
+    size_t num_tokens = 0;
+    clock_t start = clock();
+    double seconds = 0;
+    int i = 0;
+
+    for (i = 0; i < NUM_RUNS; ++i) {
+        jc_init_n(&state, source, len);
+        jc_set_trusted_input(&state, trusted);
+        while ((result = jc_next_token(&state, &token)) == JC_RESULT_OK) {
+            ++num_tokens;
+        }
+    }
+
+    seconds = (double) (clock() - start) / CLOCKS_PER_SEC;
+    printf("%-8s %10lu tokens %10.1f MB/s, R 0x%03X\n",
+            trusted ? "trusted" : "checked",
+            (unsigned long) (num_tokens / NUM_RUNS),
+            len * (double) NUM_RUNS / seconds / 1e6, result);
+    return seconds;
+}
+
+int main()
+{
+    static char record[512];
+    char * source = NULL;
+    size_t len = 0;
+    size_t i = 0;
+    double checked = 0;
+    double trusted = 0;
+
+    source = malloc(NUM_RECORDS * sizeof(record));
+    if (source == NULL) {
+        return 1;
+    }
+
+    source[len++] = '[';
+    for (i = 0; i < NUM_RECORDS; ++i) {
+        sprintf(record, RECORD_TEMPLATE, (int) i, (int) (i * 31),
+                (i % 3 == 0) ? "false" : "true", (int) i % 977,
+                (int) i % 100, (int) i % 99999);
+        strcpy(source + len, record);
+        len += strlen(record);
+        source[len++] = (i + 1 < NUM_RECORDS) ? ',' : ']';
+    }
+
+    checked = run(source, len, 0);
+    trusted = run(source, len, 1);
+    printf("speedup  %.2fx\n", checked / trusted);
+
+    free(source);
+    return 0;
+}
@@ -0,0 +1,412 @@
+#define _POSIX_C_SOURCE 200112L
+#define JC_PATH_TRACKING
+#include "jc.h"
+#include "ndjson_util.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+/*
+ * Exports fields of the records of an NDJSON file, selected by JSON Pointers,
+ * as CSV or TSV.
+ *
+ * Columns are compiled into the path hashes of their pointers and of all
+ * their proper prefixes. While a record is tokenized, objects and arrays whose
+ * path is neither a column nor a prefix of one are skipped with
+ * `jc_skip_container`, and tokenizing stops once all columns were found.
+ * Objects and arrays that are columns are skipped as well, unless other
+ * columns are under them. String values are unescaped and escaped for the
+ * output format in a single pass, which copies runs of characters without
+ * escape sequences as a whole.
+ * Object and array values are written as raw JSON, and null or missing values
+ * as empty fields. CSV fields that hold strings or JSON are quoted, with
+ * double quotes doubled; TSV fields escape tabs, newlines, carriage returns and
+ * backslashes with backslashes.
+ *
+ * With many threads, the file is cut at record boundaries into chunks; every
+ * thread converts a chunk into its own buffer, and buffers are written in
+ * chunk order, so the output doesn't depend on the number of threads.
+ */
+
+#define MAX_COLUMNS 64
+#define MAX_PREFIXES 256
+#define MAX_POINTER_SIZE 1024
+#define MAX_THREADS 64
+#define CHUNK_SIZE (4 * 1024 * 1024)
+#define OUTPUT_BUFFER_SIZE (1024 * 1024)
+
+typedef struct {
+    unsigned long hashes[MAX_COLUMNS];
+    size_t num_columns;
+    unsigned long prefixes[MAX_PREFIXES];
+    size_t num_prefixes;
+    int tsv;
+} columns;
+
+typedef struct {
+    char * data;
+    size_t len;
+    size_t capacity;
+    int failed;
+} output;
+
+typedef struct {
+    pthread_t thread;
+    columns const * cols;
+    char const * source;
+    size_t start;
+    size_t end;
+    output out;
+} worker;
+
+void print_usage()
+{
+    printf("Usage: ./ndjson_csv csv|tsv <ndjson-file> <threads> <pointer>...\n");
+}
+
+void put(output * out, char const * data, size_t len)
+{
+    if (len == 0) {
+        return;
+    } else if (out->len + len > out->capacity) {
+        out->capacity = (out->len + len) * 2;
+        out->data = realloc(out->data, out->capacity);
+        if (out->data == NULL) {
+            out->failed = 1;
+            out->len = 0;
+            out->capacity = 0;
+            return;
+        }
+    }
+
+    memcpy(out->data + out->len, data, len);
+    out->len += len;
+}
+
+/*
+ * Writes characters that need no more decoding, escaped for the format
+ */
+void put_escaped(output * out, char const * data, size_t len, int tsv)
+{
+    size_t start = 0;
+    size_t pos = 0;
+
+    for (pos = 0; pos < len; ++pos) {
+        if (!tsv && data[pos] == '"') {
+            put(out, data + start, pos + 1 - start);
+            start = pos;
+        } else if (tsv && strchr("\t\n\r\\", data[pos]) != NULL
+                && data[pos] != '\0') {
+            put(out, data + start, pos - start);
+            put(out, "\\", 1);
+            put(out, data[pos] == '\t' ? "t" : data[pos] == '\n' ? "n"
+                   : data[pos] == '\r' ? "r" : "\\", 1);
+            start = pos + 1;
+        }
+    }
+
+    put(out, data + start, len - start);
+}
+
+/*
+ * Returns the length of the escape sequence at the start of `data`, covering
+ * both halves of an escaped surrogate pair
+ */
+size_t escape_length(char const * data, size_t len)
+{
+    if (len < 2 || data[1] != 'u') {
+        return len < 2 ? len : 2;
+    } else if (len < 6) {
+        return len;
+    }
+
+    return (len >= 12 && (data[2] == 'd' || data[2] == 'D')
+            && strchr("89abAB", data[3]) != NULL && data[3] != '\0'
+            && data[6] == '\\' && data[7] == 'u') ? 12 : 6;
+}
+
+/*
+ * Writes the contents of a string token unescaped and then escaped for the
+ * format. Invalid escape sequences are written as they are.
+ */
+void put_string(output * out, char const * data, size_t len, int tsv)
+{
+    char decoded[8];
+    char const * backslash = NULL;
+    size_t decoded_len = 0;
+    size_t run_len = 0;
+    size_t pos = 0;
+
+    while (pos < len) {
+        backslash = memchr(data + pos, '\\', len - pos);
+        run_len = (backslash != NULL) ? (size_t) (backslash - data) - pos
+                                      : len - pos;
+        put_escaped(out, data + pos, run_len, tsv);
+        pos += run_len;
+        if (pos == len) {
+            break;
+        }
+
+        run_len = escape_length(data + pos, len - pos);
+        if (jc_decode_string(data + pos, run_len, decoded, sizeof(decoded),
+                             &decoded_len) == JC_RESULT_OK) {
+            put_escaped(out, decoded, decoded_len, tsv);
+        } else {
+            put_escaped(out, data + pos, run_len, tsv);
+        }
+        pos += run_len;
+    }
+}
+
+size_t find_hash(unsigned long const * hashes, size_t num_hashes,
+                 unsigned long hash)
+{
+    size_t i = 0;
+
+    for (i = 0; i < num_hashes && hashes[i] != hash; ++i);
+    return i;
+}
+
+/*
+ * Adds a column with the hashes of its pointer and its proper prefixes,
+ * returns 0 if there are too many
+ */
+int add_column(columns * cols, char const * pointer)
+{
+    char prefix[MAX_POINTER_SIZE];
+    size_t len = 0;
+    unsigned long hash = 0;
+
+    if (cols->num_columns == MAX_COLUMNS || strlen(pointer) >= sizeof(prefix)) {
+        return 0;
+    }
+    cols->hashes[cols->num_columns++] = jc_pointer_hash(pointer);
+
+    for (len = 0; pointer[len] != '\0'; ++len) {
+        if (pointer[len] != '/') {
+            continue;
+        }
+
+        memcpy(prefix, pointer, len);
+        prefix[len] = '\0';
+        hash = jc_pointer_hash(prefix);
+        if (find_hash(cols->prefixes, cols->num_prefixes, hash)
+                < cols->num_prefixes) {
+            continue;
+        } else if (cols->num_prefixes == MAX_PREFIXES) {
+            return 0;
+        }
+        cols->prefixes[cols->num_prefixes++] = hash;
+    }
+
+    return 1;
+}
+
+/*
+ * Writes the row of a record; tokenizes it only as far as needed to find all
+ * columns. Every column takes the first value under its pointer.
+ */
+void convert_record(columns const * cols, char const * source, size_t start,
+                    size_t end, output * out)
+{
+    jc_state jc;
+    jc_state copy;
+    jc_state * skipper = NULL;
+    jc_token token;
+    jc_token container_end;
+    jc_token values[MAX_COLUMNS];
+    char found[MAX_COLUMNS];
+    unsigned long hash = 0;
+    size_t num_found = 0;
+    size_t column = 0;
+    int is_container = 0;
+    int is_prefix = 0;
+
+    for (column = 0; column < cols->num_columns; ++column) {
+        values[column].type = JC_TOKEN_TYPE_NULL;
+        found[column] = 0;
+    }
+
+    jc_init_span(&jc, source, start, end);
+    while (num_found < cols->num_columns
+            && jc_next_token(&jc, &token) == JC_RESULT_OK) {
+        is_container = (token.type & (JC_TOKEN_TYPE_OBJECT_START
+                                      | JC_TOKEN_TYPE_ARRAY_START)) != 0;
+        if (!is_container && !(token.type & (JC_TOKEN_TYPE_NUMBER
+                | JC_TOKEN_TYPE_STRING | JC_TOKEN_TYPE_TRUE
+                | JC_TOKEN_TYPE_FALSE | JC_TOKEN_TYPE_NULL))) {
+            continue;
+        }
+
+        hash = jc_path_hash(&jc);
+        is_prefix = is_container && find_hash(cols->prefixes,
+                                              cols->num_prefixes, hash)
+                                    < cols->num_prefixes;
+        if (find_hash(cols->hashes, cols->num_columns, hash)
+                == cols->num_columns) {
+            if (is_container && !is_prefix) {
+                jc_skip_container(&jc);
+            }
+            continue;
+        }
+
+        /* Columns under a selected container still need its contents */
+        if (is_container) {
+            skipper = &jc;
+            if (is_prefix) {
+                copy = jc;
+                skipper = &copy;
+            }
+            jc_skip_container(skipper);
+            if (jc_next_token(skipper, &container_end) != JC_RESULT_OK) {
+                break;
+            }
+            token.end = container_end.end;
+        }
+
+        /* The same pointer may be selected by many columns */
+        for (column = 0; column < cols->num_columns; ++column) {
+            if (cols->hashes[column] == hash && !found[column]) {
+                values[column] = token;
+                found[column] = 1;
+                ++num_found;
+            }
+        }
+    }
+
+    for (column = 0; column < cols->num_columns; ++column) {
+        if (column > 0) {
+            put(out, cols->tsv ? "\t" : ",", 1);
+        }
+
+        token = values[column];
+        switch (token.type) {
+        case JC_TOKEN_TYPE_NULL:
+            break;
+        case JC_TOKEN_TYPE_STRING:
+            put(out, "\"", !cols->tsv);
+            put_string(out, source + token.start, token.end - token.start,
+                       cols->tsv);
+            put(out, "\"", !cols->tsv);
+            break;
+        case JC_TOKEN_TYPE_OBJECT_START:
+        case JC_TOKEN_TYPE_ARRAY_START:
+            put(out, "\"", !cols->tsv);
+            put_escaped(out, source + token.start, token.end - token.start,
+                        cols->tsv);
+            put(out, "\"", !cols->tsv);
+            break;
+        default:
+            put(out, source + token.start, token.end - token.start);
+            break;
+        }
+    }
+    put(out, "\n", 1);
+}
+
+void * run_worker(void * arg)
+{
+    worker * w = arg;
+    size_t pos = w->start;
+    size_t start = 0;
+    size_t end = 0;
+
+    w->out.len = 0;
+    while (jc_next_record(w->source, w->end, &pos, &start, &end)) {
+        convert_record(w->cols, w->source, start, end, &w->out);
+    }
+
+    return NULL;
+}
+
+int main(int argc, char const * argv[])
+{
+    static columns cols;
+    static worker workers[MAX_THREADS];
+    output header = { NULL, 0, 0, 0 };
+    char const * source = NULL;
+    size_t size = 0;
+    size_t num_threads = 0;
+    size_t pos = 0;
+    size_t i = 0;
+    int arg = 0;
+
+    if (argc < 5 || (strcmp(argv[1], "csv") != 0
+            && strcmp(argv[1], "tsv") != 0)) {
+        print_usage();
+        return 0;
+    }
+
+    cols.tsv = strcmp(argv[1], "tsv") == 0;
+    num_threads = strtoul(argv[3], NULL, 10);
+    if (num_threads == 0 || num_threads > MAX_THREADS) {
+        printf("Error: use 1-%d threads\n", MAX_THREADS);
+        return 1;
+    }
+
+    for (arg = 4; arg < argc; ++arg) {
+        if (!add_column(&cols, argv[arg])) {
+            printf("Error: too many or too long columns\n");
+            return 1;
+        }
+        if (arg > 4) {
+            put(&header, cols.tsv ? "\t" : ",", 1);
+        }
+        put(&header, "\"", !cols.tsv);
+        put_escaped(&header, argv[arg], strlen(argv[arg]), cols.tsv);
+        put(&header, "\"", !cols.tsv);
+    }
+    put(&header, "\n", 1);
+
+    source = map_file(argv[2], &size);
+    if (source == NULL) {
+        return 1;
+    }
+
+    setvbuf(stdout, NULL, _IOFBF, OUTPUT_BUFFER_SIZE);
+    fwrite(header.data, 1, header.len, stdout);
+
+    /* Every round converts one chunk per thread, then writes them in order */
+    while (pos < size) {
+        for (i = 0; i < num_threads; ++i) {
+            workers[i].cols = &cols;
+            workers[i].source = source;
+            workers[i].start = pos;
+            workers[i].end = skip_to_record_start(source, size, pos,
+                                                  pos + CHUNK_SIZE);
+            pos = workers[i].end;
+            if (num_threads == 1) {
+                run_worker(&workers[i]);
+            } else if (pthread_create(&workers[i].thread, NULL, run_worker,
+                                      &workers[i]) != 0) {
+                perror("Can't start thread");
+                return 1;
+            }
+        }
+
+        for (i = 0; i < num_threads; ++i) {
+            if (num_threads > 1) {
+                pthread_join(workers[i].thread, NULL);
+            }
+            if (workers[i].out.failed) {
+                perror("Can't grow output buffer");
+                return 1;
+            }
+            if (workers[i].out.len > 0) {
+                fwrite(workers[i].out.data, 1, workers[i].out.len, stdout);
+            }
+        }
+    }
+
+    if (fflush(stdout) != 0) {
+        perror("Can't write output");
+        return 1;
+    }
+
+    for (i = 0; i < num_threads; ++i) {
+        free(workers[i].out.data);
+    }
+    free(header.data);
+
+    return 0;
+}
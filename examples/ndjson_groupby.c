@@ -0,0 +1,158 @@
+#define _POSIX_C_SOURCE 200112L
+#define JC_PATH_TRACKING
+#include "jc.h"
+#include "ndjson_util.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+/*
+ * Counts the records of an NDJSON file by the value under a JSON Pointer, and
+ * prints every distinct value with its count, most frequent first.
+ *
+ * Values are encoded with a `jc_dict`, so every distinct value is copied into
+ * the dictionary arena once, and records are counted in an array indexed by
+ * the codes. Values are taken as their JSON text, with quotes for strings, so
+ * that e.g. "1" and 1 are different values; strings are not decoded, so
+ * differently escaped strings are different values, too. Records without the
+ * value, and values that don't fit into the dictionary anymore, are counted
+ * separately.
+ */
+
+#define DEFAULT_ARENA_SIZE (16 * 1024 * 1024)
+#define BYTES_PER_ENTRY 64
+
+/* Counts by code, for sorting codes with qsort */
+static size_t * counts = NULL;
+
+void print_usage()
+{
+    printf("Usage: ./ndjson_groupby <ndjson-file> <pointer> "
+           "[dictionary-size-in-kb]\n");
+}
+
+/*
+ * Tokenizes a record until the first scalar value under the key path, and
+ * stores it into `value`, including the quotes of a string. Returns 0 if there
+ * is none.
+ */
+int find_value(char const * source, size_t start, size_t end,
+               unsigned long path_hash, int path_depth, jc_token * value)
+{
+    jc_state jc;
+
+    jc_init_span(&jc, source, start, end);
+    jc_set_max_emit_depth(&jc, path_depth);
+    if (jc_find_path_value(&jc, path_hash, value) != JC_RESULT_OK) {
+        return 0;
+    }
+
+    if (value->type == JC_TOKEN_TYPE_STRING) {
+        --value->start;
+        ++value->end;
+    }
+    return 1;
+}
+
+int compare_codes(void const * a, void const * b)
+{
+    size_t count_a = counts[*(size_t const *) a];
+    size_t count_b = counts[*(size_t const *) b];
+
+    if (count_a != count_b) {
+        return count_a < count_b ? 1 : -1;
+    } else if (*(size_t const *) a == *(size_t const *) b) {
+        return 0;
+    }
+    return *(size_t const *) a < *(size_t const *) b ? -1 : 1;
+}
+
+int main(int argc, char const * argv[])
+{
+    jc_dict dict;
+    jc_token value;
+    size_t * arena = NULL;
+    size_t * codes = NULL;
+    size_t arena_size = DEFAULT_ARENA_SIZE;
+    char const * source = NULL;
+    char const * data = NULL;
+    size_t size = 0;
+    size_t pos = 0;
+    size_t start = 0;
+    size_t end = 0;
+    size_t code = 0;
+    size_t len = 0;
+    size_t num_records = 0;
+    size_t num_missing = 0;
+    size_t num_overflowed = 0;
+    size_t values_len = 0;
+    unsigned long path_hash = 0;
+    int path_depth = 0;
+
+    if (argc != 3 && argc != 4) {
+        print_usage();
+        return 0;
+    }
+
+    if (argc == 4) {
+        arena_size = strtoul(argv[3], NULL, 10) * 1024;
+    }
+
+    arena = malloc(arena_size > 0 ? arena_size : 1);
+    counts = calloc(arena_size / BYTES_PER_ENTRY + 1, sizeof(size_t));
+    codes = malloc((arena_size / BYTES_PER_ENTRY + 1) * sizeof(size_t));
+    if (arena == NULL || counts == NULL || codes == NULL) {
+        perror("Can't allocate dictionary");
+        return 1;
+    } else if (jc_dict_init(&dict, arena, arena_size,
+                            arena_size / BYTES_PER_ENTRY) != JC_RESULT_OK) {
+        printf("Error: dictionary size is too small\n");
+        return 1;
+    }
+
+    source = map_file(argv[1], &size);
+    if (source == NULL) {
+        return 1;
+    }
+
+    path_depth = jc_pointer_depth(argv[2]);
+    path_hash = jc_pointer_hash(argv[2]);
+
+    while (jc_next_record(source, size, &pos, &start, &end)) {
+        ++num_records;
+        if (!find_value(source, start, end, path_hash, path_depth, &value)) {
+            ++num_missing;
+            continue;
+        }
+
+        values_len += value.end - value.start;
+        if (jc_dict_encode(&dict, source + value.start,
+                           value.end - value.start, &code) != JC_RESULT_OK) {
+            ++num_overflowed;
+            continue;
+        }
+        ++counts[code];
+    }
+
+    for (code = 0; code < dict.num_entries; ++code) {
+        codes[code] = code;
+    }
+    qsort(codes, dict.num_entries, sizeof(size_t), compare_codes);
+
+    for (code = 0; code < dict.num_entries; ++code) {
+        jc_dict_decode(&dict, codes[code], &data, &len);
+        printf("%lu\t%.*s\n", (unsigned long) counts[codes[code]], (int) len,
+               data);
+    }
+
+    fprintf(stderr, "%lu records, %lu distinct values in %lu dictionary "
+            "bytes for %lu value bytes, %lu without value, %lu not fitting "
+            "into the dictionary\n", (unsigned long) num_records,
+            (unsigned long) dict.num_entries,
+            (unsigned long) dict.strings_len, (unsigned long) values_len,
+            (unsigned long) num_missing, (unsigned long) num_overflowed);
+
+    free(codes);
+    free(counts);
+    free(arena);
+    return 0;
+}
@@ -0,0 +1,246 @@
+#define _POSIX_C_SOURCE 200112L
+#include "jc.h"
+#include "ndjson_util.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+/*
+ * Builds a record offset index of an NDJSON file and stores it next to the
+ * file, then uses it to print record N without scanning the file, or to split
+ * the file into byte ranges holding equal numbers of records for parallel
+ * jobs.
+ *
+ * Index file layout: an 8-byte magic, then the checkpoint interval, the number
+ * of records, the number of checkpoints, the length of the delta stream and
+ * the size of the indexed file, then the checkpoints as pairs of offset and
+ * delta position, all as 64-bit little-endian integers, and finally the delta
+ * stream. The file size is checked on load to detect stale indexes.
+ */
+
+#define INDEX_MAGIC "JCRIDX1"
+#define INDEX_HEADER_FIELDS 5
+#define INDEX_HEADER_SIZE (8 + INDEX_HEADER_FIELDS * 8)
+#define DEFAULT_INTERVAL 64
+
+void print_usage()
+{
+    printf("Usage: ./ndjson_index build <ndjson-file> <index-file> "
+           "[interval]\n");
+    printf("       ./ndjson_index get <ndjson-file> <index-file> <record>\n");
+    printf("       ./ndjson_index split <ndjson-file> <index-file> <jobs>\n");
+}
+
+int build(char const * path, char const * index_path, size_t interval)
+{
+    jc_record_index index;
+    jc_result result;
+    char const * source = NULL;
+    size_t size = 0;
+    FILE * file = NULL;
+    size_t i = 0;
+
+    source = map_file(path, &size);
+    if (source == NULL) {
+        return 1;
+    }
+
+    jc_record_index_init(&index, malloc(1024 * sizeof(jc_record_checkpoint)),
+                         1024, malloc(64 * 1024), 64 * 1024, interval);
+    if (index.checkpoints == NULL || index.deltas == NULL) {
+        perror("Can't allocate index");
+        return 1;
+    }
+
+    while ((result = jc_record_index_build(&index, source, size))
+            == JC_RESULT_ERR_BUFFER_FULL) {
+        if (index.num_checkpoints == index.max_checkpoints) {
+            index.max_checkpoints *= 2;
+            index.checkpoints = realloc(index.checkpoints,
+                index.max_checkpoints * sizeof(jc_record_checkpoint));
+        } else {
+            index.deltas_size *= 2;
+            index.deltas = realloc(index.deltas, index.deltas_size);
+        }
+
+        if (index.checkpoints == NULL || index.deltas == NULL) {
+            perror("Can't grow index");
+            return 1;
+        }
+    }
+
+    file = fopen(index_path, "wb");
+    if (file == NULL || fwrite(INDEX_MAGIC, 1, 8, file) != 8
+            || !write_u64(file, index.interval)
+            || !write_u64(file, index.num_records)
+            || !write_u64(file, index.num_checkpoints)
+            || !write_u64(file, index.deltas_len)
+            || !write_u64(file, size)) {
+        perror("Can't write index");
+        return 1;
+    }
+    for (i = 0; i < index.num_checkpoints; ++i) {
+        if (!write_u64(file, index.checkpoints[i].offset)
+                || !write_u64(file, index.checkpoints[i].delta_pos)) {
+            perror("Can't write index");
+            return 1;
+        }
+    }
+    if (fwrite(index.deltas, 1, index.deltas_len, file) != index.deltas_len
+            || fclose(file) != 0) {
+        perror("Can't write index");
+        return 1;
+    }
+
+    printf("Indexed %lu records of %lu bytes: %lu checkpoints, %lu delta "
+            "bytes, %.2f bytes per record\n", (unsigned long) index.num_records,
+            (unsigned long) size, (unsigned long) index.num_checkpoints,
+            (unsigned long) index.deltas_len,
+            index.num_records > 0
+                ? (index.num_checkpoints * 16.0 + index.deltas_len)
+                    / index.num_records
+                : 0.0);
+    return 0;
+}
+
+int load(char const * index_path, size_t source_size, jc_record_index * index)
+{
+    FILE * file = fopen(index_path, "rb");
+    char magic[8];
+    size_t header[INDEX_HEADER_FIELDS];
+    size_t index_size = 0;
+    long file_size = 0;
+    size_t i = 0;
+
+    if (file == NULL || fread(magic, 1, 8, file) != 8
+            || memcmp(magic, INDEX_MAGIC, 8) != 0) {
+        printf("Error: %s is not a record index\n", index_path);
+        return 0;
+    }
+    for (i = 0; i < INDEX_HEADER_FIELDS; ++i) {
+        if (!read_u64(file, &header[i])) {
+            printf("Error: %s is truncated\n", index_path);
+            return 0;
+        }
+    }
+    if (header[4] != source_size) {
+        printf("Error: %s is stale, rebuild it\n", index_path);
+        return 0;
+    }
+
+    /* Checkpoints and deltas have to fill the rest of the file exactly */
+    if (fseek(file, 0, SEEK_END) == 0
+            && (file_size = ftell(file)) >= INDEX_HEADER_SIZE) {
+        index_size = file_size - INDEX_HEADER_SIZE;
+    }
+    if (header[0] == 0 || header[2] > index_size / 16
+            || header[3] != index_size - header[2] * 16
+            || fseek(file, INDEX_HEADER_SIZE, SEEK_SET) != 0) {
+        printf("Error: %s is truncated\n", index_path);
+        return 0;
+    }
+
+    jc_record_index_init(index,
+                         malloc((header[2] + 1) * sizeof(jc_record_checkpoint)),
+                         header[2], malloc(header[3] + 1), header[3],
+                         header[0]);
+    if (index->checkpoints == NULL || index->deltas == NULL) {
+        perror("Can't load index");
+        return 0;
+    }
+
+    for (i = 0; i < header[2]; ++i) {
+        if (!read_u64(file, &index->checkpoints[i].offset)
+                || !read_u64(file, &index->checkpoints[i].delta_pos)) {
+            printf("Error: %s is truncated\n", index_path);
+            return 0;
+        }
+    }
+    if (fread(index->deltas, 1, header[3], file) != header[3]) {
+        printf("Error: %s is truncated\n", index_path);
+        return 0;
+    }
+    fclose(file);
+
+    index->num_records = header[1];
+    index->num_checkpoints = header[2];
+    index->deltas_len = header[3];
+    return 1;
+}
+
+int get(char const * path, char const * index_path, size_t record)
+{
+    jc_record_index index;
+    jc_result result;
+    char const * source = NULL;
+    size_t size = 0;
+    size_t offset = 0;
+
+    source = map_file(path, &size);
+    if (source == NULL || !load(index_path, size, &index)) {
+        return 1;
+    }
+
+    result = jc_record_index_get(&index, record, &offset);
+    if (result != JC_RESULT_OK || offset > size) {
+        printf("Error: no record %lu, R 0x%03X\n", (unsigned long) record,
+                result);
+        return 1;
+    }
+
+    fwrite(source + offset, 1, jc_find_record_end(source, size, offset) - offset,
+           stdout);
+    putchar('\n');
+    return 0;
+}
+
+int split(char const * path, char const * index_path, size_t num_jobs)
+{
+    jc_record_index index;
+    char const * source = NULL;
+    size_t size = 0;
+    size_t first = 0;
+    size_t next = 0;
+    size_t start = 0;
+    size_t end = 0;
+    size_t i = 0;
+
+    source = map_file(path, &size);
+    if (source == NULL || !load(index_path, size, &index)) {
+        return 1;
+    }
+
+    for (i = 0; i < num_jobs; ++i) {
+        first = index.num_records * i / num_jobs;
+        next = index.num_records * (i + 1) / num_jobs;
+        if (jc_record_index_get(&index, first, &start) != JC_RESULT_OK
+                || start > size) {
+            start = size;
+        }
+        if (jc_record_index_get(&index, next, &end) != JC_RESULT_OK
+                || end > size) {
+            end = size;
+        }
+        printf("job %lu: records %lu-%lu, bytes %lu-%lu\n", (unsigned long) i,
+                (unsigned long) first, (unsigned long) next,
+                (unsigned long) start, (unsigned long) end);
+    }
+
+    return 0;
+}
+
+int main(int argc, char const * argv[])
+{
+    if ((argc == 4 || argc == 5) && strcmp(argv[1], "build") == 0) {
+        return build(argv[2], argv[3], argc == 5
+                                      ? strtoul(argv[4], NULL, 10)
+                                      : DEFAULT_INTERVAL);
+    } else if (argc == 5 && strcmp(argv[1], "get") == 0) {
+        return get(argv[2], argv[3], strtoul(argv[4], NULL, 10));
+    } else if (argc == 5 && strcmp(argv[1], "split") == 0
+            && strtoul(argv[4], NULL, 10) > 0) {
+        return split(argv[2], argv[3], strtoul(argv[4], NULL, 10));
+    }
+
+    print_usage();
+    return 0;
+}
@@ -0,0 +1,241 @@
+#define _POSIX_C_SOURCE 200112L
+#define JC_PATH_TRACKING
+#include "jc.h"
+#include "ndjson_util.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+/*
+ * Builds a hash index from the value of one key path to the offsets of the
+ * records of an NDJSON file that have it, and looks records up by value in it.
+ *
+ * The index is an open-addressing hash table with linear probing that is
+ * stored as is, so lookups map the index file and probe it without loading
+ * anything. Its size is the smallest power of two that keeps it at most three
+ * quarters full. A slot holds the hash of the key path and value, as in
+ * `jc_path_hash`, and the record offset plus one, so that zero marks empty
+ * slots. Values are hashed by their raw text, i.e. strings without quotes and
+ * still escaped. Records with equal hashes are all candidates; each of them is
+ * tokenized to check its value, so collisions can't produce wrong results.
+ *
+ * Index file layout: an 8-byte magic, then the version, the size of the
+ * indexed file, the path hash of the key, the number of records, the number of
+ * keys and the number of slots, and finally the slots as pairs of hash and
+ * offset plus one, all as 64-bit little-endian integers. Slots are probed in
+ * place in the mapped file. The file size is checked on load to detect stale
+ * indexes.
+ */
+
+#define KEYINDEX_MAGIC "JCKIDX1"
+#define KEYINDEX_VERSION 2
+#define KEYINDEX_HEADER_SIZE (8 + 6 * 8)
+#define SLOT_SIZE 16
+
+typedef struct {
+    unsigned long version;
+    unsigned long source_size;
+    unsigned long path_hash;
+    unsigned long num_records;
+    unsigned long num_keys;
+    unsigned long num_slots;
+} keyindex_header;
+
+void print_usage()
+{
+    printf("Usage: ./ndjson_keyindex build <ndjson-file> <index-file> "
+           "<pointer>\n");
+    printf("       ./ndjson_keyindex get <ndjson-file> <index-file> <value>\n");
+}
+
+unsigned long slot_hash(unsigned char const * slots, size_t i)
+{
+    return get_u64(slots + i * SLOT_SIZE);
+}
+
+size_t slot_offset(unsigned char const * slots, size_t i)
+{
+    return get_u64(slots + i * SLOT_SIZE + 8);
+}
+
+/*
+ * Tokenizes a record until the first scalar value under the key path, and
+ * stores it into `value`. Returns 0 if there is none.
+ */
+int find_key(char const * source, size_t start, size_t end,
+             unsigned long path_hash, jc_token * value)
+{
+    jc_state jc;
+
+    jc_init_span(&jc, source, start, end);
+    return jc_find_path_value(&jc, path_hash, value) == JC_RESULT_OK;
+}
+
+int build(char const * path, char const * index_path, char const * pointer)
+{
+    keyindex_header header;
+    unsigned char bytes[KEYINDEX_HEADER_SIZE];
+    unsigned char * slots = NULL;
+    jc_token value;
+    char const * source = NULL;
+    size_t size = 0;
+    size_t pos = 0;
+    size_t start = 0;
+    size_t end = 0;
+    size_t i = 0;
+    unsigned long hash = 0;
+    FILE * file = NULL;
+
+    source = map_file(path, &size);
+    if (source == NULL) {
+        return 1;
+    }
+
+    memset(&header, 0, sizeof(header));
+    header.version = KEYINDEX_VERSION;
+    header.source_size = size;
+    header.path_hash = jc_pointer_hash(pointer);
+    header.num_records = jc_count_records(source, size);
+    for (header.num_slots = 1;
+            header.num_slots * 3 < header.num_records * 4;
+            header.num_slots *= 2);
+
+    slots = calloc(header.num_slots, SLOT_SIZE);
+    if (slots == NULL) {
+        perror("Can't allocate index");
+        return 1;
+    }
+
+    while (jc_next_record(source, size, &pos, &start, &end)) {
+        if (!find_key(source, start, end, header.path_hash, &value)) {
+            continue;
+        }
+
+        hash = jc_hash(header.path_hash, source + value.start,
+                       value.end - value.start);
+        for (i = jc_mix_hash(hash) & (header.num_slots - 1);
+                slot_offset(slots, i) != 0;
+                i = (i + 1) & (header.num_slots - 1));
+        put_u64(slots + i * SLOT_SIZE, hash);
+        put_u64(slots + i * SLOT_SIZE + 8, start + 1);
+        ++header.num_keys;
+    }
+
+    memcpy(bytes, KEYINDEX_MAGIC, 8);
+    put_u64(bytes + 8, header.version);
+    put_u64(bytes + 16, header.source_size);
+    put_u64(bytes + 24, header.path_hash);
+    put_u64(bytes + 32, header.num_records);
+    put_u64(bytes + 40, header.num_keys);
+    put_u64(bytes + 48, header.num_slots);
+
+    file = fopen(index_path, "wb");
+    if (file == NULL || fwrite(bytes, 1, sizeof(bytes), file) != sizeof(bytes)
+            || fwrite(slots, SLOT_SIZE, header.num_slots, file)
+                != header.num_slots
+            || fclose(file) != 0) {
+        perror("Can't write index");
+        return 1;
+    }
+
+    printf("Indexed %lu of %lu records in %lu slots, %lu bytes\n",
+            header.num_keys, header.num_records, header.num_slots,
+            (unsigned long) (sizeof(bytes) + header.num_slots * SLOT_SIZE));
+    free(slots);
+    return 0;
+}
+
+/*
+ * Finds all records of `source` whose key equals `value` through the mapped
+ * slots of an index, and prints them. Returns the number of records found.
+ */
+size_t lookup(keyindex_header const * header, unsigned char const * slots,
+              char const * source, size_t size, char const * value,
+              size_t * num_probes)
+{
+    size_t value_len = strlen(value);
+    unsigned long hash = jc_hash(header->path_hash, value, value_len);
+    size_t pos = 0;
+    size_t end = 0;
+    size_t num_found = 0;
+    size_t i = jc_mix_hash(hash) & (header->num_slots - 1);
+    jc_token token;
+
+    for (; slot_offset(slots, i) != 0 && *num_probes < header->num_slots;
+            i = (i + 1) & (header->num_slots - 1)) {
+        ++*num_probes;
+        pos = slot_offset(slots, i) - 1;
+        if (slot_hash(slots, i) != hash || pos >= size) {
+            continue;
+        }
+
+        end = jc_find_record_end(source, size, pos);
+        if (find_key(source, pos, end, header->path_hash, &token)
+                && token.end - token.start == value_len
+                && memcmp(source + token.start, value, value_len) == 0) {
+            fwrite(source + pos, 1, end - pos, stdout);
+            putchar('\n');
+            ++num_found;
+        }
+    }
+
+    return num_found;
+}
+
+int get(char const * path, char const * index_path, char const * value)
+{
+    keyindex_header header;
+    unsigned char const * index = NULL;
+    char const * source = NULL;
+    size_t size = 0;
+    size_t index_size = 0;
+    size_t num_probes = 0;
+    size_t num_found = 0;
+
+    source = map_file(path, &size);
+    index = (unsigned char const *) map_file(index_path, &index_size);
+    if (source == NULL || index == NULL) {
+        return 1;
+    }
+
+    if (index_size < KEYINDEX_HEADER_SIZE
+            || memcmp(index, KEYINDEX_MAGIC, 8) != 0
+            || get_u64(index + 8) != KEYINDEX_VERSION) {
+        printf("Error: %s is not a compatible key index\n", index_path);
+        return 1;
+    }
+
+    header.version = get_u64(index + 8);
+    header.source_size = get_u64(index + 16);
+    header.path_hash = get_u64(index + 24);
+    header.num_records = get_u64(index + 32);
+    header.num_keys = get_u64(index + 40);
+    header.num_slots = get_u64(index + 48);
+    if (header.num_slots == 0
+            || (header.num_slots & (header.num_slots - 1)) != 0
+            || (index_size - KEYINDEX_HEADER_SIZE) / SLOT_SIZE
+                < header.num_slots) {
+        printf("Error: %s is truncated\n", index_path);
+        return 1;
+    } else if (header.source_size != size) {
+        printf("Error: %s is stale, rebuild it\n", index_path);
+        return 1;
+    }
+
+    num_found = lookup(&header, index + KEYINDEX_HEADER_SIZE, source, size,
+                       value, &num_probes);
+    fprintf(stderr, "%lu matching records, probed %lu slots\n",
+            (unsigned long) num_found, (unsigned long) num_probes);
+    return num_found > 0 ? 0 : 1;
+}
+
+int main(int argc, char const * argv[])
+{
+    if (argc == 5 && strcmp(argv[1], "build") == 0) {
+        return build(argv[2], argv[3], argv[4]);
+    } else if (argc == 5 && strcmp(argv[1], "get") == 0) {
+        return get(argv[2], argv[3], argv[4]);
+    }
+
+    print_usage();
+    return 0;
+}
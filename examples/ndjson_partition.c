@@ -0,0 +1,273 @@
+#define _POSIX_C_SOURCE 200112L
+#define JC_PATH_TRACKING
+#include "jc.h"
+#include "ndjson_util.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+ * Routes the records of an NDJSON file to shard files by the value under
+ * a JSON Pointer, from many threads.
+ *
+ * Every thread takes a range of the file that starts and ends at a record
+ * boundary.
+ * For each record it tokenizes only up to the routing value, skipping the
+ * contents of objects and arrays nested deeper than the pointer, and hashes
+ * the raw text of the value to pick a shard. Records without the value go to
+ * an extra `unrouted` file. Raw record bytes are copied into a buffer of the
+ * thread for that shard, and full buffers are appended to the shard file with
+ * a single write. Shard files are opened with O_APPEND, so writes of many
+ * threads never overlap, and records are added to existing files. Records of
+ * a shard keep their order within a thread's range only.
+ */
+
+#define MAX_SHARDS 1024
+#define MAX_THREADS 64
+#define SHARD_BUFFER_SIZE (64 * 1024)
+
+typedef struct {
+    char * data;
+    size_t len;
+} shard_buffer;
+
+typedef struct {
+    pthread_t thread;
+    char const * source;
+    size_t start;
+    size_t end;
+    unsigned long path_hash;
+    int path_depth;
+    size_t num_shards;
+    int const * fds;
+    shard_buffer * buffers;
+    size_t num_records;
+    size_t num_unrouted;
+    int failed;
+} worker;
+
+void print_usage()
+{
+    printf("Usage: ./ndjson_partition <ndjson-file> <pointer> <shards> "
+           "<output-prefix> [threads]\n");
+}
+
+int write_all(int fd, char const * data, size_t len)
+{
+    ssize_t num_written = 0;
+
+    while (len > 0) {
+        num_written = write(fd, data, len);
+        if (num_written < 0 && errno == EINTR) {
+            continue;
+        } else if (num_written <= 0) {
+            return 0;
+        }
+
+        data += num_written;
+        len -= num_written;
+    }
+
+    return 1;
+}
+
+/*
+ * Writes a record and its newline with a single call, so that writes of other
+ * threads can't land between them. Returns 0 on failure or a short write.
+ */
+int write_record(int fd, char const * record, size_t len)
+{
+    struct iovec parts[2];
+    ssize_t num_written = 0;
+
+    parts[0].iov_base = (void *) record;
+    parts[0].iov_len = len;
+    parts[1].iov_base = "\n";
+    parts[1].iov_len = 1;
+    do {
+        num_written = writev(fd, parts, 2);
+    } while (num_written < 0 && errno == EINTR);
+
+    return num_written == (ssize_t) (len + 1);
+}
+
+/*
+ * Appends a record and its newline to the buffer of a shard, writing the
+ * buffer out first if it can't hold them, or the record directly if no
+ * buffer can
+ */
+int append_record(worker * w, size_t shard, char const * record, size_t len)
+{
+    shard_buffer * buffer = &w->buffers[shard];
+
+    if (buffer->len + len + 1 > SHARD_BUFFER_SIZE) {
+        if (!write_all(w->fds[shard], buffer->data, buffer->len)) {
+            return 0;
+        }
+        buffer->len = 0;
+    }
+
+    if (len + 1 > SHARD_BUFFER_SIZE) {
+        return write_record(w->fds[shard], record, len);
+    }
+
+    memcpy(buffer->data + buffer->len, record, len);
+    buffer->data[buffer->len + len] = '\n';
+    buffer->len += len + 1;
+    return 1;
+}
+
+/*
+ * Returns the shard of a record, or `num_shards` if it has no routing value.
+ * Tokenizing stops at the routing value.
+ */
+size_t route_record(worker const * w, size_t start, size_t end)
+{
+    jc_state jc;
+    jc_token token;
+
+    jc_init_span(&jc, w->source, start, end);
+    jc_set_max_emit_depth(&jc, w->path_depth);
+    if (jc_find_path_value(&jc, w->path_hash, &token) != JC_RESULT_OK) {
+        return w->num_shards;
+    }
+
+    return jc_hash(JC_HASH_INIT, w->source + token.start,
+                   token.end - token.start) % w->num_shards;
+}
+
+void * run_worker(void * arg)
+{
+    worker * w = arg;
+    size_t pos = w->start;
+    size_t start = 0;
+    size_t end = 0;
+    size_t shard = 0;
+
+    while (!w->failed
+            && jc_next_record(w->source, w->end, &pos, &start, &end)) {
+        shard = route_record(w, start, end);
+        w->num_unrouted += shard == w->num_shards;
+        ++w->num_records;
+        w->failed = !append_record(w, shard, w->source + start, end - start);
+    }
+
+    for (shard = 0; shard <= w->num_shards && !w->failed; ++shard) {
+        w->failed = !write_all(w->fds[shard], w->buffers[shard].data,
+                               w->buffers[shard].len);
+    }
+
+    return NULL;
+}
+
+double elapsed_seconds(struct timespec const * from, struct timespec const * to)
+{
+    return (to->tv_sec - from->tv_sec) + (to->tv_nsec - from->tv_nsec) / 1e9;
+}
+
+int main(int argc, char const * argv[])
+{
+    static worker workers[MAX_THREADS];
+    static int fds[MAX_SHARDS + 1];
+    char path[4096];
+    char const * source = NULL;
+    size_t size = 0;
+    size_t num_shards = 0;
+    size_t num_threads = 0;
+    size_t num_records = 0;
+    size_t num_unrouted = 0;
+    size_t i = 0;
+    size_t j = 0;
+    struct timespec start;
+    struct timespec end;
+
+    if (argc != 5 && argc != 6) {
+        print_usage();
+        return 0;
+    }
+
+    num_shards = strtoul(argv[3], NULL, 10);
+    num_threads = (argc == 6) ? strtoul(argv[5], NULL, 10)
+                              : (size_t) sysconf(_SC_NPROCESSORS_ONLN);
+    if (num_shards == 0 || num_shards > MAX_SHARDS || num_threads == 0
+            || num_threads > MAX_THREADS) {
+        printf("Error: use 1-%d shards and 1-%d threads\n", MAX_SHARDS,
+                MAX_THREADS);
+        return 1;
+    }
+
+    source = map_file(argv[1], &size);
+    if (source == NULL) {
+        return 1;
+    }
+
+    for (i = 0; i <= num_shards; ++i) {
+        if (i < num_shards) {
+            sprintf(path, "%.4000s-%03lu.ndjson", argv[4], (unsigned long) i);
+        } else {
+            sprintf(path, "%.4000s-unrouted.ndjson", argv[4]);
+        }
+        fds[i] = open(path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+        if (fds[i] < 0) {
+            perror("Can't open shard file");
+            return 1;
+        }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < num_threads; ++i) {
+        workers[i].source = source;
+        workers[i].start = (i > 0) ? workers[i - 1].end : 0;
+        workers[i].end = (i + 1 < num_threads)
+                       ? skip_to_record_start(source, size, workers[i].start,
+                                              size / num_threads * (i + 1))
+                       : size;
+        workers[i].path_hash = jc_pointer_hash(argv[2]);
+        workers[i].path_depth = jc_pointer_depth(argv[2]);
+        workers[i].num_shards = num_shards;
+        workers[i].fds = fds;
+        workers[i].buffers = calloc(num_shards + 1, sizeof(shard_buffer));
+        for (j = 0; workers[i].buffers != NULL && j <= num_shards; ++j) {
+            workers[i].buffers[j].data = malloc(SHARD_BUFFER_SIZE);
+            workers[i].failed |= workers[i].buffers[j].data == NULL;
+        }
+        if (workers[i].buffers == NULL || workers[i].failed) {
+            perror("Can't allocate shard buffers");
+            return 1;
+        }
+
+        if (pthread_create(&workers[i].thread, NULL, run_worker,
+                           &workers[i]) != 0) {
+            perror("Can't start thread");
+            return 1;
+        }
+    }
+
+    for (i = 0; i < num_threads; ++i) {
+        pthread_join(workers[i].thread, NULL);
+        if (workers[i].failed) {
+            perror("Can't write shard file");
+            return 1;
+        }
+        num_records += workers[i].num_records;
+        num_unrouted += workers[i].num_unrouted;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    for (i = 0; i <= num_shards; ++i) {
+        close(fds[i]);
+    }
+
+    printf("Routed %lu records (%lu unrouted) of %lu bytes to %lu shards "
+            "with %lu threads in %.3f s, %.1f MB/s\n",
+            (unsigned long) num_records, (unsigned long) num_unrouted,
+            (unsigned long) size, (unsigned long) num_shards,
+            (unsigned long) num_threads, elapsed_seconds(&start, &end),
+            size / 1e6 / elapsed_seconds(&start, &end));
+    return 0;
+}
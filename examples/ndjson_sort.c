@@ -0,0 +1,511 @@
+#define _POSIX_C_SOURCE 200112L
+#define JC_PATH_TRACKING
+#include "jc.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+/*
+ * Sorts the records of an NDJSON file by the value under a JSON Pointer in
+ * bounded memory.
+ *
+ * The input is read in chunks that take half of the memory budget. The key of
+ * every record of a chunk is found once and decoded with `jc_decode_integer`
+ * or `jc_decode_string` into a fixed-size radix key: integers with their sign
+ * bit flipped, strings as their first bytes in big-endian order. Records are
+ * then sorted by radix key with an LSD radix sort that skips passes over
+ * bytes which are the same in all keys. String keys with equal radix keys are
+ * compared in full afterwards, up to MAX_KEY_SIZE bytes if they have escape
+ * sequences that have to be decoded. A sorted chunk is written into
+ * a temporary run file, and runs are merged through a binary heap. Files are
+ * read and written through large buffers, so all I/O is sequential.
+ *
+ * Records without the key, or with a key of the other type, sort first. In
+ * int mode so do records whose key is a number that isn't an integer in the
+ * range of long, e.g. 1.5, 1e3 or a huge one; they are counted and reported
+ * after sorting. Records with equal keys keep their order.
+ */
+
+#define DEFAULT_MEMORY_MB 256
+#define IO_BUFFER_SIZE (1024 * 1024)
+#define MIN_RUN_BUFFER_SIZE (64 * 1024)
+#define MAX_KEY_SIZE 1024
+#define RADIX_BITS 8
+#define RADIX_SIZE (1 << RADIX_BITS)
+
+/*
+ * Describes a record in memory and in run files, where it precedes the record
+ * and its newline. The key position is relative to the record.
+ */
+typedef struct {
+    unsigned long key;
+    unsigned long has_key;
+    unsigned long key_start;
+    unsigned long key_len;
+    unsigned long len;
+} record_header;
+
+typedef struct {
+    record_header header;
+    size_t offset;
+} entry;
+
+typedef struct {
+    FILE * file;
+    record_header header;
+    char * data;
+    size_t capacity;
+} run_reader;
+
+typedef struct {
+    unsigned long path_hash;
+    int path_depth;
+    int strings;
+    size_t memory;
+} sort_options;
+
+/*
+ * Chunk that entries compared by `compare_entries` point into
+ */
+static char const * sorted_chunk = NULL;
+static int sorted_strings = 0;
+
+void print_usage()
+{
+    printf("Usage: ./ndjson_sort int|string <pointer> <input-file> "
+           "<output-file> [memory-mb]\n");
+}
+
+/*
+ * Finds the first scalar value under the key path in a record, and fills in
+ * the key of its header. Returns 0 if the key is a number that int mode
+ * can't sort by, 1 otherwise.
+ */
+int extract_key(char const * record, sort_options const * options,
+                 record_header * header)
+{
+    jc_state jc;
+    jc_token token;
+    char prefix[sizeof(unsigned long) + 1];
+    size_t len = 0;
+    size_t i = 0;
+    long value = 0;
+    jc_result result;
+
+    header->key = 0;
+    header->has_key = 0;
+    header->key_start = 0;
+    header->key_len = 0;
+
+    jc_init_n(&jc, record, header->len);
+    jc_set_max_emit_depth(&jc, options->path_depth);
+    if (jc_find_path_value(&jc, options->path_hash, &token) != JC_RESULT_OK) {
+        return 1;
+    } else if (!options->strings && token.type == JC_TOKEN_TYPE_NUMBER) {
+        if (jc_decode_integer(record + token.start, token.end - token.start,
+                              &value) != JC_RESULT_OK) {
+            return 0;
+        }
+        header->key = (unsigned long) value
+                    ^ ((unsigned long) LONG_MAX + 1);
+        header->has_key = 1;
+    } else if (options->strings && token.type == JC_TOKEN_TYPE_STRING) {
+        result = jc_decode_string(record + token.start,
+                                  token.end - token.start, prefix,
+                                  sizeof(prefix), &len);
+        if (result == JC_RESULT_ERR_UNEXPECTED_TOKEN) {
+            return 1;
+        }
+        for (i = 0; i < sizeof(unsigned long); ++i) {
+            header->key = (header->key << 8)
+                        | (i < len ? (unsigned char) prefix[i] : 0);
+        }
+        header->has_key = 1;
+    }
+
+    header->key_start = token.start;
+    header->key_len = token.end - token.start;
+    return 1;
+}
+
+/*
+ * Compares two records by key: first whether they have one, then radix keys,
+ * then whole string keys
+ */
+int compare_keys(char const * a_record, record_header const * a,
+                 char const * b_record, record_header const * b)
+{
+    char a_key[MAX_KEY_SIZE];
+    char b_key[MAX_KEY_SIZE];
+    size_t a_len = 0;
+    size_t b_len = 0;
+    int order = 0;
+
+    if (a->has_key != b->has_key) {
+        return a->has_key < b->has_key ? -1 : 1;
+    } else if (a->key != b->key) {
+        return a->key < b->key ? -1 : 1;
+    } else if (!sorted_strings || !a->has_key) {
+        return 0;
+    }
+
+    /* Keys without escape sequences are compared without decoding */
+    if (memchr(a_record + a->key_start, '\\', a->key_len) == NULL
+            && memchr(b_record + b->key_start, '\\', b->key_len) == NULL) {
+        a_len = a->key_len;
+        b_len = b->key_len;
+        order = memcmp(a_record + a->key_start, b_record + b->key_start,
+                       a_len < b_len ? a_len : b_len);
+    } else {
+        jc_decode_string(a_record + a->key_start, a->key_len, a_key,
+                         sizeof(a_key), &a_len);
+        jc_decode_string(b_record + b->key_start, b->key_len, b_key,
+                         sizeof(b_key), &b_len);
+        order = memcmp(a_key, b_key, a_len < b_len ? a_len : b_len);
+    }
+    if (order == 0) {
+        order = (a_len > b_len) - (a_len < b_len);
+    }
+
+    return order;
+}
+
+int compare_entries(void const * a, void const * b)
+{
+    entry const * x = a;
+    entry const * y = b;
+    int order = compare_keys(sorted_chunk + x->offset, &x->header,
+                             sorted_chunk + y->offset, &y->header);
+
+    if (order == 0) {
+        order = (x->offset > y->offset) - (x->offset < y->offset);
+    }
+
+    return order;
+}
+
+/*
+ * Returns digit `pass` of the radix key of an entry, from the least
+ * significant; the last one is whether it has a key at all
+ */
+size_t radix_digit(entry const * e, size_t pass)
+{
+    if (pass == sizeof(unsigned long)) {
+        return e->header.has_key;
+    }
+
+    return (e->header.key >> (pass * RADIX_BITS)) & (RADIX_SIZE - 1);
+}
+
+/*
+ * Sorts entries by radix key, stably, using `temp` of the same size
+ */
+void radix_sort(entry * entries, entry * temp, size_t num_entries)
+{
+    size_t counts[RADIX_SIZE];
+    entry * from = entries;
+    entry * to = temp;
+    entry * swap = NULL;
+    size_t pass = 0;
+    size_t total = 0;
+    size_t count = 0;
+    size_t i = 0;
+
+    for (pass = 0; pass <= sizeof(unsigned long); ++pass) {
+        memset(counts, 0, sizeof(counts));
+        for (i = 0; i < num_entries; ++i) {
+            ++counts[radix_digit(&from[i], pass)];
+        }
+        if (num_entries == 0
+                || counts[radix_digit(&from[0], pass)] == num_entries) {
+            continue;
+        }
+
+        for (i = 0, total = 0; i < RADIX_SIZE; ++i) {
+            count = counts[i];
+            counts[i] = total;
+            total += count;
+        }
+        for (i = 0; i < num_entries; ++i) {
+            to[counts[radix_digit(&from[i], pass)]++] = from[i];
+        }
+
+        swap = from;
+        from = to;
+        to = swap;
+    }
+
+    if (from != entries) {
+        memcpy(entries, from, num_entries * sizeof(entry));
+    }
+}
+
+/*
+ * Sorts the entries of a chunk: by radix key, then groups of string keys with
+ * equal radix keys by whole keys
+ */
+void sort_chunk(char const * chunk, entry * entries, entry * temp,
+                size_t num_entries)
+{
+    size_t start = 0;
+    size_t end = 0;
+
+    radix_sort(entries, temp, num_entries);
+    if (!sorted_strings) {
+        return;
+    }
+
+    sorted_chunk = chunk;
+    for (start = 0; start < num_entries; start = end) {
+        for (end = start + 1; end < num_entries
+                && entries[end].header.has_key
+                && entries[end].header.key == entries[start].header.key;
+                ++end);
+        if (end - start > 1 && entries[start].header.has_key) {
+            qsort(entries + start, end - start, sizeof(entry),
+                  compare_entries);
+        }
+    }
+}
+
+int write_record(FILE * file, char const * record, record_header const * header,
+                 int with_header)
+{
+    return (!with_header || fwrite(header, sizeof(*header), 1, file) == 1)
+        && fwrite(record, 1, header->len, file) == header->len
+        && putc('\n', file) != EOF;
+}
+
+int read_run_record(run_reader * run)
+{
+    if (fread(&run->header, sizeof(run->header), 1, run->file) != 1) {
+        return 0;
+    }
+
+    if (run->header.len + 1 > run->capacity) {
+        run->capacity = run->header.len + 1;
+        run->data = realloc(run->data, run->capacity);
+        if (run->data == NULL) {
+            return 0;
+        }
+    }
+
+    return fread(run->data, 1, run->header.len + 1, run->file)
+            == run->header.len + 1;
+}
+
+/*
+ * Returns whether the head record of run `a` goes before that of run `b`;
+ * runs hold consecutive chunks, so ties go to the earlier run
+ */
+int run_precedes(run_reader const * runs, size_t a, size_t b)
+{
+    int order = compare_keys(runs[a].data, &runs[a].header,
+                             runs[b].data, &runs[b].header);
+    return order < 0 || (order == 0 && a < b);
+}
+
+void sift_down(run_reader const * runs, size_t * heap, size_t heap_size,
+               size_t i)
+{
+    size_t child = 0;
+    size_t top = 0;
+
+    for (;;) {
+        top = i;
+        child = 2 * i + 1;
+        if (child < heap_size && run_precedes(runs, heap[child], heap[top])) {
+            top = child;
+        }
+        if (child + 1 < heap_size
+                && run_precedes(runs, heap[child + 1], heap[top])) {
+            top = child + 1;
+        }
+        if (top == i) {
+            return;
+        }
+
+        child = heap[i];
+        heap[i] = heap[top];
+        heap[top] = child;
+        i = top;
+    }
+}
+
+int merge_runs(FILE ** files, size_t num_runs, FILE * output,
+               size_t memory)
+{
+    run_reader * runs = calloc(num_runs, sizeof(run_reader));
+    size_t * heap = malloc(num_runs * sizeof(size_t));
+    size_t buffer_size = memory / num_runs;
+    size_t heap_size = 0;
+    size_t i = 0;
+    run_reader * run = NULL;
+
+    if (runs == NULL || heap == NULL) {
+        perror("Can't allocate runs");
+        return 0;
+    }
+
+    buffer_size = buffer_size > IO_BUFFER_SIZE ? IO_BUFFER_SIZE : buffer_size;
+    buffer_size = buffer_size < MIN_RUN_BUFFER_SIZE
+                ? MIN_RUN_BUFFER_SIZE
+                : buffer_size;
+    for (i = 0; i < num_runs; ++i) {
+        runs[i].file = files[i];
+        rewind(runs[i].file);
+        setvbuf(runs[i].file, NULL, _IOFBF, buffer_size);
+        if (read_run_record(&runs[i])) {
+            heap[heap_size++] = i;
+        }
+    }
+    for (i = heap_size; i > 0; --i) {
+        sift_down(runs, heap, heap_size, i - 1);
+    }
+
+    while (heap_size > 0) {
+        run = &runs[heap[0]];
+        if (!write_record(output, run->data, &run->header, 0)) {
+            perror("Can't write output");
+            return 0;
+        }
+
+        if (!read_run_record(run)) {
+            heap[0] = heap[--heap_size];
+        }
+        sift_down(runs, heap, heap_size, 0);
+    }
+
+    for (i = 0; i < num_runs; ++i) {
+        fclose(runs[i].file);
+        free(runs[i].data);
+    }
+    free(runs);
+    free(heap);
+    return 1;
+}
+
+int sort(char const * input_path, char const * output_path,
+         sort_options const * options)
+{
+    FILE * input = fopen(input_path, "rb");
+    FILE * output = fopen(output_path, "wb");
+    FILE ** runs = NULL;
+    size_t num_runs = 0;
+    size_t chunk_size = options->memory / 2;
+    size_t max_entries = options->memory / 4 / sizeof(entry);
+    char * chunk = malloc(chunk_size);
+    entry * entries = malloc(max_entries * sizeof(entry));
+    entry * temp = malloc(max_entries * sizeof(entry));
+    size_t num_entries = 0;
+    size_t num_records = 0;
+    size_t num_unsortable = 0;
+    size_t filled = 0;
+    size_t pos = 0;
+    size_t start = 0;
+    size_t end = 0;
+    size_t i = 0;
+    int at_eof = 0;
+    int single_run = 0;
+
+    if (input == NULL || output == NULL) {
+        perror("Can't open files");
+        return 1;
+    } else if (chunk == NULL || entries == NULL || temp == NULL
+            || max_entries == 0) {
+        perror("Can't allocate chunk");
+        return 1;
+    }
+    setvbuf(output, NULL, _IOFBF, IO_BUFFER_SIZE);
+
+    do {
+        filled += fread(chunk + filled, 1, chunk_size - filled, input);
+        at_eof = filled < chunk_size;
+
+        /* Take complete records while there's room for their entries */
+        for (pos = 0, num_entries = 0; num_entries < max_entries
+                && jc_next_record(chunk, filled, &pos, &start, &end);
+                ++num_entries) {
+            if (end == filled && !at_eof) {
+                pos = start;
+                break;
+            }
+
+            entries[num_entries].offset = start;
+            entries[num_entries].header.len = end - start;
+            num_unsortable += !extract_key(chunk + start, options,
+                                           &entries[num_entries].header);
+        }
+        pos = pos > filled ? filled : pos;
+
+        if (num_entries == 0 && pos == 0 && filled == chunk_size) {
+            printf("Error: a record is longer than the memory budget\n");
+            return 1;
+        }
+
+        sorted_strings = options->strings;
+        sort_chunk(chunk, entries, temp, num_entries);
+        num_records += num_entries;
+
+        /* A single chunk is written directly, without merging */
+        single_run = (num_runs == 0 && at_eof && pos == filled);
+        if (!single_run && num_runs % 16 == 0) {
+            runs = realloc(runs, (num_runs + 16) * sizeof(FILE *));
+        }
+        if (!single_run && (runs == NULL
+                || (runs[num_runs++] = tmpfile()) == NULL)) {
+            perror("Can't create run");
+            return 1;
+        }
+
+        for (i = 0; i < num_entries; ++i) {
+            if (!write_record(single_run ? output : runs[num_runs - 1],
+                              chunk + entries[i].offset, &entries[i].header,
+                              !single_run)) {
+                perror("Can't write run");
+                return 1;
+            }
+        }
+
+        memmove(chunk, chunk + pos, filled - pos);
+        filled -= pos;
+    } while (!at_eof || filled > 0);
+
+    free(chunk);
+    free(entries);
+    free(temp);
+    fclose(input);
+    if (num_runs > 0 && !merge_runs(runs, num_runs, output, options->memory)) {
+        return 1;
+    }
+    if (fclose(output) != 0) {
+        perror("Can't write output");
+        return 1;
+    }
+
+    fprintf(stderr, "Sorted %lu records in %lu runs\n",
+            (unsigned long) num_records, (unsigned long) num_runs);
+    if (num_unsortable > 0) {
+        fprintf(stderr, "%lu records have keys that aren't integers and sort "
+                "first\n", (unsigned long) num_unsortable);
+    }
+    free(runs);
+    return 0;
+}
+
+int main(int argc, char const * argv[])
+{
+    sort_options options;
+
+    if ((argc != 5 && argc != 6) || (strcmp(argv[1], "int") != 0
+            && strcmp(argv[1], "string") != 0)) {
+        print_usage();
+        return 0;
+    }
+
+    options.strings = strcmp(argv[1], "string") == 0;
+    options.path_hash = jc_pointer_hash(argv[2]);
+    options.path_depth = jc_pointer_depth(argv[2]);
+    options.memory = (argc == 6 ? strtoul(argv[5], NULL, 10)
+                                : DEFAULT_MEMORY_MB) * 1024 * 1024;
+    return sort(argv[3], argv[4], &options);
+}
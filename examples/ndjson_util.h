@@ -0,0 +1,140 @@
+#ifndef NDJSON_UTIL_H
+#define NDJSON_UTIL_H
+
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/*
+ * Helpers shared by the NDJSON examples. Like jc.h, this header contains
+ * definitions, so it's included by exactly one translation unit per program.
+ */
+
+/*
+ * Maps a whole file read-only, returns NULL on failure
+ */
+char const * map_file(char const * path, size_t * size)
+{
+    int fd = open(path, O_RDONLY);
+    struct stat file_stat;
+    void * data = NULL;
+
+    if (fd < 0 || fstat(fd, &file_stat) != 0) {
+        perror("Can't open file");
+        if (fd >= 0) {
+            close(fd);
+        }
+        return NULL;
+    }
+
+    *size = file_stat.st_size;
+    data = mmap(NULL, *size > 0 ? *size : 1, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        perror("Can't map file");
+        return NULL;
+    }
+
+    return data;
+}
+
+/*
+ * Returns the start of the first record that starts at or after `target`, or
+ * `len` if there is none. Records are followed from `pos`, which has to be
+ * the start of a record, with `jc_find_record_end`, so that newlines inside of
+ * strings don't end records here either. This costs a search for quotes and
+ * newlines but no tokenizing.
+ */
+size_t skip_to_record_start(char const * source, size_t len, size_t pos,
+                            size_t target)
+{
+    while (pos < target && pos < len) {
+        pos = jc_find_record_end(source, len, pos) + 1;
+    }
+
+    return pos < len ? pos : len;
+}
+
+/*
+ * Index files written by the examples store integers as 64-bit little-endian
+ * fields and doubles as their IEEE 754 bytes in little-endian order, so that
+ * they don't depend on the host that built them.
+ */
+
+void put_u64(unsigned char * bytes, size_t value)
+{
+    int i = 0;
+
+    for (i = 0; i < 8; ++i) {
+        bytes[i] = (unsigned char) (value & 0xFF);
+        value >>= 8;
+    }
+}
+
+size_t get_u64(unsigned char const * bytes)
+{
+    size_t value = 0;
+    int i = 0;
+
+    for (i = 7; i >= 0; --i) {
+        value = (value << 8) | bytes[i];
+    }
+    return value;
+}
+
+int write_u64(FILE * file, size_t value)
+{
+    unsigned char bytes[8];
+
+    put_u64(bytes, value);
+    return fwrite(bytes, 1, 8, file) == 8;
+}
+
+int read_u64(FILE * file, size_t * value)
+{
+    unsigned char bytes[8];
+
+    if (fread(bytes, 1, 8, file) != 8) {
+        return 0;
+    }
+
+    *value = get_u64(bytes);
+    return 1;
+}
+
+/*
+ * Stores a double into 8 bytes, assuming that the host stores doubles in the
+ * byte order of its integers
+ */
+void put_double(unsigned char * bytes, double value)
+{
+    unsigned long probe = 1;
+    unsigned char host[8];
+    int little_endian = *(unsigned char *) &probe == 1;
+    int i = 0;
+
+    memcpy(host, &value, 8);
+    for (i = 0; i < 8; ++i) {
+        bytes[i] = host[little_endian ? i : 7 - i];
+    }
+}
+
+double get_double(unsigned char const * bytes)
+{
+    unsigned long probe = 1;
+    unsigned char host[8];
+    int little_endian = *(unsigned char *) &probe == 1;
+    double value = 0;
+    int i = 0;
+
+    for (i = 0; i < 8; ++i) {
+        host[little_endian ? i : 7 - i] = bytes[i];
+    }
+    memcpy(&value, host, 8);
+    return value;
+}
+
+#endif /* NDJSON_UTIL_H */
@@ -0,0 +1,569 @@
+#define _POSIX_C_SOURCE 200112L
+#define JC_PATH_TRACKING
+#include "jc.h"
+#include "ndjson_util.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+/*
+ * Builds data skipping indexes of an NDJSON file in one tokenizing pass, and
+ * uses them to answer queries by tokenizing only the blocks that may match.
+ *
+ * The file is cut at record boundaries into blocks of about the given size.
+ * For every block the index stores a Bloom filter of the hashes of (path,
+ * value) pairs of all scalar values, and the minimum and maximum of the
+ * numbers found under each path, up to ZONE_MAX_PATHS paths. Paths are hashed
+ * by path tracking as their JSON Pointers, and values by their raw text, i.e.
+ * strings without quotes and still escaped. Filters are built at maximum size
+ * and then folded in halves while they keep BLOOM_BITS_PER_VALUE bits for
+ * every value that set a new bit.
+ *
+ * Index file layout: an 8-byte magic, then the version, the size of the
+ * indexed file, the block size, the number of blocks and the length of the
+ * filter bits as 64-bit little-endian integers, then the block descriptors,
+ * and finally the filter bits of all blocks. A descriptor holds the fields of
+ * `block_index` in order, with `ZONE_MAX_PATHS` zones of a path hash and two
+ * doubles. The file size is checked on load to detect stale indexes.
+ */
+
+#define ZONEMAP_MAGIC "JCZMAP1"
+#define ZONEMAP_VERSION 2
+#define ZONEMAP_HEADER_SIZE (8 + 5 * 8)
+#define BLOCK_RECORD_SIZE (8 * 8 + ZONE_MAX_PATHS * 3 * 8)
+#define DEFAULT_BLOCK_SIZE (1024 * 1024)
+#define ZONE_MAX_PATHS 32
+#define BLOOM_MAX_BITS (1UL << 22)
+#define BLOOM_MIN_BITS 512
+#define BLOOM_BITS_PER_VALUE 10
+#define BLOOM_NUM_HASHES 4
+#define MAX_NUMBER_LEN 64
+
+typedef struct {
+    unsigned long path_hash;
+    double min;
+    double max;
+} zone;
+
+typedef struct {
+    unsigned long start;
+    unsigned long end;
+    unsigned long num_records;
+    unsigned long num_values;
+    unsigned long bloom_offset;
+    unsigned long bloom_bits;
+    unsigned long num_zones;
+    unsigned long zones_overflowed;
+    zone zones[ZONE_MAX_PATHS];
+} block_index;
+
+typedef struct {
+    unsigned long version;
+    unsigned long source_size;
+    unsigned long block_size;
+    unsigned long num_blocks;
+    unsigned long bloom_len;
+} zonemap_header;
+
+typedef struct {
+    zonemap_header header;
+    block_index * blocks;
+    unsigned char * bloom;
+} zonemap;
+
+/*
+ * What a query looks for: values equal to `value`, or numbers in the range
+ * from `min` to `max`, under the path with hash `path_hash` and depth
+ * `path_depth`
+ */
+typedef struct {
+    unsigned long path_hash;
+    int path_depth;
+    char const * value;
+    size_t value_len;
+    int is_range;
+    double min;
+    double max;
+} query;
+
+void print_usage()
+{
+    printf("Usage: ./ndjson_zonemap build <ndjson-file> <index-file> "
+           "[block-size]\n");
+    printf("       ./ndjson_zonemap eq <ndjson-file> <index-file> <pointer> "
+           "<value>\n");
+    printf("       ./ndjson_zonemap range <ndjson-file> <index-file> "
+           "<pointer> <min> <max>\n");
+}
+
+int is_value(jc_token const * token)
+{
+    return (token->type & (JC_TOKEN_TYPE_NUMBER | JC_TOKEN_TYPE_STRING
+                           | JC_TOKEN_TYPE_TRUE | JC_TOKEN_TYPE_FALSE
+                           | JC_TOKEN_TYPE_NULL)) != 0;
+}
+
+/*
+ * Converts a number token, which isn't null-terminated in the source
+ */
+double number_value(char const * source, jc_token const * token)
+{
+    char digits[MAX_NUMBER_LEN + 1];
+    size_t len = token->end - token->start;
+
+    if (len > MAX_NUMBER_LEN) {
+        len = MAX_NUMBER_LEN;
+    }
+    memcpy(digits, source + token->start, len);
+    digits[len] = '\0';
+    return strtod(digits, NULL);
+}
+
+unsigned long bloom_step(unsigned long hash)
+{
+    return (hash >> 16) | 1;
+}
+
+/*
+ * Sets the bits of `hash`, returns whether any of them wasn't set yet
+ */
+int bloom_add(unsigned char * bloom, unsigned long bits, unsigned long hash)
+{
+    unsigned long step = 0;
+    unsigned long bit = 0;
+    int added = 0;
+    int i = 0;
+
+    hash = jc_mix_hash(hash);
+    step = bloom_step(hash);
+    for (i = 0; i < BLOOM_NUM_HASHES; ++i, hash += step) {
+        bit = hash & (bits - 1);
+        added |= !(bloom[bit / 8] & (1 << (bit % 8)));
+        bloom[bit / 8] |= (unsigned char) (1 << (bit % 8));
+    }
+
+    return added;
+}
+
+int bloom_test(unsigned char const * bloom, unsigned long bits,
+               unsigned long hash)
+{
+    unsigned long step = 0;
+    unsigned long bit = 0;
+    int i = 0;
+
+    hash = jc_mix_hash(hash);
+    step = bloom_step(hash);
+    for (i = 0; i < BLOOM_NUM_HASHES; ++i, hash += step) {
+        bit = hash & (bits - 1);
+        if (!(bloom[bit / 8] & (1 << (bit % 8)))) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+/*
+ * Halves the filter by merging its upper half into the lower one while it
+ * still has enough bits per value, and returns its new number of bits. Bit
+ * positions are taken modulo a power of two, so a folded filter answers the
+ * same lookups.
+ */
+unsigned long bloom_fold(unsigned char * bloom, unsigned long bits,
+                         unsigned long num_values)
+{
+    size_t i = 0;
+
+    while (bits > BLOOM_MIN_BITS
+            && bits / 2 >= num_values * BLOOM_BITS_PER_VALUE) {
+        bits /= 2;
+        for (i = 0; i < bits / 8; ++i) {
+            bloom[i] |= bloom[i + bits / 8];
+        }
+    }
+
+    return bits;
+}
+
+void zone_add(block_index * block, unsigned long path_hash, double value)
+{
+    size_t i = 0;
+
+    for (i = 0; i < block->num_zones; ++i) {
+        if (block->zones[i].path_hash == path_hash) {
+            if (value < block->zones[i].min) {
+                block->zones[i].min = value;
+            }
+            if (value > block->zones[i].max) {
+                block->zones[i].max = value;
+            }
+            return;
+        }
+    }
+
+    if (block->num_zones == ZONE_MAX_PATHS) {
+        block->zones_overflowed = 1;
+        return;
+    }
+
+    block->zones[block->num_zones].path_hash = path_hash;
+    block->zones[block->num_zones].min = value;
+    block->zones[block->num_zones].max = value;
+    ++block->num_zones;
+}
+
+/*
+ * Tokenizes the records of a block and adds their values to its filter and
+ * zones, returns the number of records that aren't valid JSON
+ */
+size_t index_block(char const * source, block_index * block,
+                   unsigned char * bloom)
+{
+    jc_state jc;
+    jc_token token;
+    jc_result result;
+    unsigned long path_hash = 0;
+    size_t pos = block->start;
+    size_t start = 0;
+    size_t end = 0;
+    size_t num_invalid = 0;
+
+    while (jc_next_record(source, block->end, &pos, &start, &end)) {
+        jc_init_span(&jc, source, start, end);
+        while ((result = jc_next_token(&jc, &token)) == JC_RESULT_OK) {
+            if (!is_value(&token)) {
+                continue;
+            }
+
+            path_hash = jc_path_hash(&jc);
+            block->num_values += bloom_add(bloom, BLOOM_MAX_BITS,
+                jc_hash(path_hash, source + token.start,
+                        token.end - token.start));
+            if (token.type == JC_TOKEN_TYPE_NUMBER) {
+                zone_add(block, path_hash, number_value(source, &token));
+            }
+        }
+
+        num_invalid += result != JC_RESULT_EOF;
+        ++block->num_records;
+    }
+
+    return num_invalid;
+}
+
+/*
+ * Encodes a block descriptor into BLOCK_RECORD_SIZE bytes
+ */
+void encode_block(unsigned char * bytes, block_index const * block)
+{
+    size_t i = 0;
+
+    put_u64(bytes, block->start);
+    put_u64(bytes + 8, block->end);
+    put_u64(bytes + 16, block->num_records);
+    put_u64(bytes + 24, block->num_values);
+    put_u64(bytes + 32, block->bloom_offset);
+    put_u64(bytes + 40, block->bloom_bits);
+    put_u64(bytes + 48, block->num_zones);
+    put_u64(bytes + 56, block->zones_overflowed);
+    for (i = 0, bytes += 64; i < ZONE_MAX_PATHS; ++i, bytes += 24) {
+        put_u64(bytes, block->zones[i].path_hash);
+        put_double(bytes + 8, block->zones[i].min);
+        put_double(bytes + 16, block->zones[i].max);
+    }
+}
+
+void decode_block(unsigned char const * bytes, block_index * block)
+{
+    size_t i = 0;
+
+    block->start = get_u64(bytes);
+    block->end = get_u64(bytes + 8);
+    block->num_records = get_u64(bytes + 16);
+    block->num_values = get_u64(bytes + 24);
+    block->bloom_offset = get_u64(bytes + 32);
+    block->bloom_bits = get_u64(bytes + 40);
+    block->num_zones = get_u64(bytes + 48);
+    block->zones_overflowed = get_u64(bytes + 56);
+    for (i = 0, bytes += 64; i < ZONE_MAX_PATHS; ++i, bytes += 24) {
+        block->zones[i].path_hash = get_u64(bytes);
+        block->zones[i].min = get_double(bytes + 8);
+        block->zones[i].max = get_double(bytes + 16);
+    }
+}
+
+int write_index(char const * index_path, zonemap const * map)
+{
+    FILE * file = fopen(index_path, "wb");
+    unsigned char bytes[BLOCK_RECORD_SIZE];
+    size_t i = 0;
+
+    if (file == NULL || fwrite(ZONEMAP_MAGIC, 1, 8, file) != 8
+            || !write_u64(file, map->header.version)
+            || !write_u64(file, map->header.source_size)
+            || !write_u64(file, map->header.block_size)
+            || !write_u64(file, map->header.num_blocks)
+            || !write_u64(file, map->header.bloom_len)) {
+        return 0;
+    }
+    for (i = 0; i < map->header.num_blocks; ++i) {
+        encode_block(bytes, &map->blocks[i]);
+        if (fwrite(bytes, 1, BLOCK_RECORD_SIZE, file) != BLOCK_RECORD_SIZE) {
+            return 0;
+        }
+    }
+
+    return fwrite(map->bloom, 1, map->header.bloom_len, file)
+            == map->header.bloom_len
+        && fclose(file) == 0;
+}
+
+int build(char const * path, char const * index_path, size_t block_size)
+{
+    zonemap map;
+    block_index * block = NULL;
+    unsigned char * scratch = malloc(BLOOM_MAX_BITS / 8);
+    char const * source = NULL;
+    size_t size = 0;
+    size_t max_blocks = 16;
+    size_t num_invalid = 0;
+    size_t pos = 0;
+    size_t start = 0;
+    size_t end = 0;
+
+    source = map_file(path, &size);
+    if (source == NULL) {
+        return 1;
+    }
+
+    memset(&map, 0, sizeof(map));
+    map.header.version = ZONEMAP_VERSION;
+    map.header.source_size = size;
+    map.header.block_size = block_size;
+    map.blocks = malloc(max_blocks * sizeof(block_index));
+    map.bloom = malloc(1);
+
+    while (jc_next_record(source, size, &pos, &start, &end)) {
+        if (map.header.num_blocks == max_blocks) {
+            max_blocks *= 2;
+            map.blocks = realloc(map.blocks, max_blocks * sizeof(block_index));
+        }
+        map.bloom = realloc(map.bloom, map.header.bloom_len
+                                       + BLOOM_MAX_BITS / 8);
+        if (scratch == NULL || map.blocks == NULL || map.bloom == NULL) {
+            perror("Can't grow index");
+            return 1;
+        }
+
+        /* A block ends with the first record that reaches its size */
+        block = &map.blocks[map.header.num_blocks++];
+        memset(block, 0, sizeof(*block));
+        block->start = start;
+        while (end - block->start < block_size
+                && jc_next_record(source, size, &pos, &start, &end));
+        block->end = pos < size ? pos : size;
+        pos = block->end;
+
+        memset(scratch, 0, BLOOM_MAX_BITS / 8);
+        num_invalid += index_block(source, block, scratch);
+        block->bloom_offset = map.header.bloom_len;
+        block->bloom_bits = bloom_fold(scratch, BLOOM_MAX_BITS,
+                                       block->num_values);
+        memcpy(map.bloom + block->bloom_offset, scratch,
+               block->bloom_bits / 8);
+        map.header.bloom_len += block->bloom_bits / 8;
+    }
+
+    if (!write_index(index_path, &map)) {
+        perror("Can't write index");
+        return 1;
+    }
+
+    printf("Indexed %lu bytes in %lu blocks: %lu filter bytes, %lu invalid "
+            "records\n", (unsigned long) size, map.header.num_blocks,
+            map.header.bloom_len, (unsigned long) num_invalid);
+    free(scratch);
+    free(map.blocks);
+    free(map.bloom);
+    return 0;
+}
+
+int load(char const * index_path, size_t source_size, zonemap * map)
+{
+    FILE * file = fopen(index_path, "rb");
+    unsigned char bytes[BLOCK_RECORD_SIZE];
+    size_t fields[5];
+    size_t index_size = 0;
+    long file_size = 0;
+    size_t i = 0;
+
+    if (file == NULL || fread(bytes, 1, ZONEMAP_HEADER_SIZE, file)
+                != ZONEMAP_HEADER_SIZE
+            || memcmp(bytes, ZONEMAP_MAGIC, 8) != 0
+            || get_u64(bytes + 8) != ZONEMAP_VERSION) {
+        printf("Error: %s is not a compatible zone map\n", index_path);
+        return 0;
+    }
+    for (i = 0; i < 5; ++i) {
+        fields[i] = get_u64(bytes + 8 + 8 * i);
+    }
+    if (fields[1] != source_size) {
+        printf("Error: %s is stale, rebuild it\n", index_path);
+        return 0;
+    }
+
+    /* Descriptors and filter bits have to fill the rest of the file exactly */
+    if (fseek(file, 0, SEEK_END) == 0
+            && (file_size = ftell(file)) >= ZONEMAP_HEADER_SIZE) {
+        index_size = file_size - ZONEMAP_HEADER_SIZE;
+    }
+    if (fields[3] > index_size / BLOCK_RECORD_SIZE
+            || fields[4] != index_size - fields[3] * BLOCK_RECORD_SIZE
+            || fseek(file, ZONEMAP_HEADER_SIZE, SEEK_SET) != 0) {
+        printf("Error: %s is truncated\n", index_path);
+        return 0;
+    }
+
+    map->header.version = fields[0];
+    map->header.source_size = fields[1];
+    map->header.block_size = fields[2];
+    map->header.num_blocks = fields[3];
+    map->header.bloom_len = fields[4];
+    map->blocks = malloc(map->header.num_blocks * sizeof(block_index) + 1);
+    map->bloom = malloc(map->header.bloom_len + 1);
+    if (map->blocks == NULL || map->bloom == NULL) {
+        perror("Can't load index");
+        return 0;
+    }
+
+    for (i = 0; i < map->header.num_blocks; ++i) {
+        if (fread(bytes, 1, BLOCK_RECORD_SIZE, file) != BLOCK_RECORD_SIZE) {
+            printf("Error: %s is truncated\n", index_path);
+            return 0;
+        }
+        decode_block(bytes, &map->blocks[i]);
+    }
+    if (fread(map->bloom, 1, map->header.bloom_len, file)
+            != map->header.bloom_len) {
+        printf("Error: %s is truncated\n", index_path);
+        return 0;
+    }
+
+    fclose(file);
+    return 1;
+}
+
+/*
+ * Returns whether the index of a block can't rule out a match
+ */
+int may_match(zonemap const * map, block_index const * block,
+              query const * q)
+{
+    size_t i = 0;
+
+    if (!q->is_range) {
+        return block->bloom_offset + block->bloom_bits / 8
+                <= map->header.bloom_len
+            && bloom_test(map->bloom + block->bloom_offset, block->bloom_bits,
+                          jc_hash(q->path_hash, q->value, q->value_len));
+    }
+
+    for (i = 0; i < block->num_zones && i < ZONE_MAX_PATHS; ++i) {
+        if (block->zones[i].path_hash == q->path_hash) {
+            return block->zones[i].min <= q->max
+                && block->zones[i].max >= q->min;
+        }
+    }
+
+    return block->zones_overflowed != 0;
+}
+
+int matches(char const * source, jc_token const * token, query const * q)
+{
+    if (q->is_range) {
+        return token->type == JC_TOKEN_TYPE_NUMBER
+            && number_value(source, token) >= q->min
+            && number_value(source, token) <= q->max;
+    }
+
+    return token->end - token->start == q->value_len
+        && memcmp(source + token->start, q->value, q->value_len) == 0;
+}
+
+int run_query(char const * path, char const * index_path, query const * q)
+{
+    zonemap map;
+    block_index const * block = NULL;
+    jc_state jc;
+    jc_token token;
+    char const * source = NULL;
+    size_t size = 0;
+    size_t pos = 0;
+    size_t start = 0;
+    size_t end = 0;
+    size_t num_read = 0;
+    size_t bytes_read = 0;
+    size_t num_matches = 0;
+    size_t i = 0;
+
+    source = map_file(path, &size);
+    if (source == NULL || !load(index_path, size, &map)) {
+        return 1;
+    }
+
+    for (i = 0; i < map.header.num_blocks; ++i) {
+        block = &map.blocks[i];
+        if (block->start > block->end || block->end > size
+                || !may_match(&map, block, q)) {
+            continue;
+        }
+
+        ++num_read;
+        bytes_read += block->end - block->start;
+        pos = block->start;
+        while (jc_next_record(source, block->end, &pos, &start, &end)) {
+            jc_init_span(&jc, source, start, end);
+            jc_set_max_emit_depth(&jc, q->path_depth);
+            if (jc_find_path_value(&jc, q->path_hash, &token) == JC_RESULT_OK
+                    && matches(source, &token, q)) {
+                fwrite(source + start, 1, end - start, stdout);
+                putchar('\n');
+                ++num_matches;
+            }
+        }
+    }
+
+    fprintf(stderr, "%lu matching records, read %lu of %lu blocks "
+            "(%lu of %lu bytes)\n", (unsigned long) num_matches,
+            (unsigned long) num_read, map.header.num_blocks,
+            (unsigned long) bytes_read, (unsigned long) size);
+    return 0;
+}
+
+int main(int argc, char const * argv[])
+{
+    query q;
+
+    memset(&q, 0, sizeof(q));
+    if ((argc == 4 || argc == 5) && strcmp(argv[1], "build") == 0) {
+        return build(argv[2], argv[3], argc == 5
+                                      ? strtoul(argv[4], NULL, 10)
+                                      : DEFAULT_BLOCK_SIZE);
+    } else if (argc == 6 && strcmp(argv[1], "eq") == 0) {
+        q.path_hash = jc_pointer_hash(argv[4]);
+        q.path_depth = jc_pointer_depth(argv[4]);
+        q.value = argv[5];
+        q.value_len = strlen(argv[5]);
+        return run_query(argv[2], argv[3], &q);
+    } else if (argc == 7 && strcmp(argv[1], "range") == 0) {
+        q.path_hash = jc_pointer_hash(argv[4]);
+        q.path_depth = jc_pointer_depth(argv[4]);
+        q.is_range = 1;
+        q.min = strtod(argv[5], NULL);
+        q.max = strtod(argv[6], NULL);
+        return run_query(argv[2], argv[3], &q);
+    }
+
+    print_usage();
+    return 0;
+}
@@ -0,0 +1,183 @@
+#define _POSIX_C_SOURCE 200112L
+#include "jc.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <time.h>
+
+/*
+ * Tokenizes every line of an NDJSON file several times from several threads
+ * through a parse cache with one mutex per shard, and reports the hit rate and
+ * throughput compared to tokenizing without the cache.
+ */
+
+#define NUM_SHARDS 16
+#define SLOT_SIZE 4096
+#define ARENA_SIZE (16 * 1024 * 1024)
+#define MAX_TOKENS 1024
+#define MAX_THREADS 64
+
+typedef struct {
+    char const * source;
+    size_t len;
+} line;
+
+typedef struct {
+    pthread_t thread;
+    jc_cache * cache;
+    line const * lines;
+    size_t num_lines;
+    size_t num_rounds;
+    size_t num_failed;
+    jc_token tokens[MAX_TOKENS];
+} worker;
+
+void print_usage()
+{
+    printf("Usage: ./parse_cache <ndjson-file> [threads] [rounds]\n");
+}
+
+void lock_mutex(void * mutex)
+{
+    pthread_mutex_lock(mutex);
+}
+
+void unlock_mutex(void * mutex)
+{
+    pthread_mutex_unlock(mutex);
+}
+
+void * run_worker(void * arg)
+{
+    worker * w = arg;
+    jc_state state;
+    size_t num_tokens = 0;
+    size_t round = 0;
+    size_t i = 0;
+
+    for (round = 0; round < w->num_rounds; ++round) {
+        for (i = 0; i < w->num_lines; ++i) {
+            if (w->cache != NULL) {
+                w->num_failed += jc_cache_tokenize(w->cache, w->lines[i].source,
+                    w->lines[i].len, w->tokens, MAX_TOKENS, &num_tokens)
+                    != JC_RESULT_OK;
+            } else {
+                jc_init_n(&state, w->lines[i].source, w->lines[i].len);
+                w->num_failed += jc_tokenize(&state, w->tokens, MAX_TOKENS,
+                                             &num_tokens) != JC_RESULT_OK;
+            }
+        }
+    }
+
+    return NULL;
+}
+
+double run(jc_cache * cache, worker * workers, size_t num_threads)
+{
+    struct timespec start;
+    struct timespec end;
+    size_t i = 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < num_threads; ++i) {
+        workers[i].cache = cache;
+        workers[i].num_failed = 0;
+        pthread_create(&workers[i].thread, NULL, run_worker, &workers[i]);
+    }
+    for (i = 0; i < num_threads; ++i) {
+        pthread_join(workers[i].thread, NULL);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    return (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+}
+
+int main(int argc, char const * argv[])
+{
+    static worker workers[MAX_THREADS];
+    static pthread_mutex_t locks[NUM_SHARDS];
+    jc_cache_shard shards[NUM_SHARDS];
+    jc_cache cache;
+    FILE * file = NULL;
+    long file_size = 0;
+    char * source = NULL;
+    line * lines = NULL;
+    size_t num_lines = 0;
+    size_t num_threads = 4;
+    size_t num_rounds = 10;
+    jc_token * arena = NULL;
+    unsigned long hits = 0;
+    unsigned long misses = 0;
+    double seconds = 0;
+    char * c = NULL;
+    size_t i = 0;
+
+    if (argc < 2) {
+        print_usage();
+        return 0;
+    }
+    if (argc > 2) {
+        num_threads = strtoul(argv[2], NULL, 10);
+    }
+    if (argc > 3) {
+        num_rounds = strtoul(argv[3], NULL, 10);
+    }
+    if (num_threads == 0 || num_threads > MAX_THREADS) {
+        print_usage();
+        return 1;
+    }
+
+    file = fopen(argv[1], "rb");
+    if (file == NULL || fseek(file, 0, SEEK_END) != 0
+            || (file_size = ftell(file)) < 0) {
+        perror("Can't open NDJSON file");
+        return 1;
+    }
+    rewind(file);
+
+    source = malloc(file_size + 1);
+    lines = malloc((file_size + 1) * sizeof(*lines));
+    arena = malloc(ARENA_SIZE);
+    if (source == NULL || lines == NULL || arena == NULL
+            || fread(source, 1, file_size, file) != (size_t) file_size) {
+        perror("Can't read NDJSON file");
+        return 1;
+    }
+    source[file_size] = '\0';
+    fclose(file);
+
+    for (c = source; *c != '\0'; c = (*c == '\n') ? c + 1 : c) {
+        lines[num_lines].source = c;
+        while (*c != '\0' && *c != '\n') {
+            ++c;
+        }
+        lines[num_lines].len = c - lines[num_lines].source;
+        num_lines += lines[num_lines].len > 0;
+    }
+
+    for (i = 0; i < num_threads; ++i) {
+        workers[i].lines = lines;
+        workers[i].num_lines = num_lines;
+        workers[i].num_rounds = num_rounds;
+    }
+
+    seconds = run(NULL, workers, num_threads);
+    printf("uncached: %8.3f s, %8.2f Mdocs/s\n", seconds,
+            num_lines * num_rounds * num_threads / seconds / 1e6);
+
+    for (i = 0; i < NUM_SHARDS; ++i) {
+        pthread_mutex_init(&locks[i], NULL);
+    }
+    jc_cache_init(&cache, shards, NUM_SHARDS, arena, ARENA_SIZE, SLOT_SIZE);
+    jc_cache_set_locks(&cache, lock_mutex, unlock_mutex, locks,
+                       sizeof(*locks));
+
+    seconds = run(&cache, workers, num_threads);
+    jc_cache_stats(&cache, &hits, &misses);
+    printf("cached:   %8.3f s, %8.2f Mdocs/s, %lu hits, %lu misses, "
+            "hit rate %.1f%%\n", seconds,
+            num_lines * num_rounds * num_threads / seconds / 1e6, hits,
+            misses, 100.0 * hits / (hits + misses));
+
+    return 0;
+}
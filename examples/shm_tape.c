@@ -0,0 +1,284 @@
+#define _POSIX_C_SOURCE 200112L
+#include "jc.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+ * Tokenizes a JSON file once and publishes its source and token tape in a
+ * POSIX shared memory segment, so that other processes on the same host can
+ * map the segment read-only and iterate over the tokens without tokenizing
+ * or copying anything.
+ *
+ * Segment layout: a header, the source string, and an array of jc_token.
+ * The publisher fills everything while the header state is WRITING and only
+ * then stores READY with release semantics; readers wait for READY with
+ * acquire semantics before looking at the rest of the header or the size of
+ * the segment. Tokens are written in place for the worst case of one token per
+ * source character; untouched pages of a shared memory object are never
+ * allocated.
+ */
+
+#define TAPE_MAGIC "JCTAPE1"
+#define TAPE_VERSION 1
+#define TAPE_ALIGNMENT 16
+#define TAPE_READY_TIMEOUT_MS 5000
+
+#define TAPE_STATE_WRITING 0
+#define TAPE_STATE_READY 1
+
+typedef struct {
+    char magic[8];
+    unsigned long version;
+    unsigned long token_size;
+    unsigned long state;
+    unsigned long result;
+    unsigned long source_offset;
+    unsigned long source_len;
+    unsigned long tokens_offset;
+    unsigned long num_tokens;
+} tape_header;
+
+void print_usage()
+{
+    printf("Usage: ./shm_tape publish <name> <json-file>\n");
+    printf("       ./shm_tape read <name>\n");
+    printf("       ./shm_tape unlink <name>\n");
+}
+
+size_t align(size_t size)
+{
+    return (size + TAPE_ALIGNMENT - 1) / TAPE_ALIGNMENT * TAPE_ALIGNMENT;
+}
+
+/*
+ * Reads exactly `len` characters, returns 0 on failure or early end of file
+ */
+int read_fully(int fd, char * buffer, size_t len)
+{
+    ssize_t num_read = 0;
+
+    while (len > 0) {
+        num_read = read(fd, buffer, len);
+        if (num_read <= 0) {
+            return 0;
+        }
+        buffer += num_read;
+        len -= num_read;
+    }
+
+    return 1;
+}
+
+/*
+ * Reports a failed publish and removes the partially written segment
+ */
+int abort_publish(char const * message, char const * name, int src_fd,
+                  void * header, size_t size)
+{
+    perror(message);
+    if (header != NULL) {
+        munmap(header, size);
+    }
+    shm_unlink(name);
+    close(src_fd);
+    return 1;
+}
+
+int publish(char const * name, char const * path)
+{
+    int src_fd = -1;
+    int shm_fd = -1;
+    struct stat src_stat;
+    tape_header * header = NULL;
+    char * source = NULL;
+    size_t tokens_offset = 0;
+    size_t size = 0;
+    size_t num_tokens = 0;
+    jc_state jc;
+    jc_result result;
+
+    src_fd = open(path, O_RDONLY);
+    if (src_fd < 0 || fstat(src_fd, &src_stat) != 0) {
+        perror("Can't open source file");
+        if (src_fd >= 0) {
+            close(src_fd);
+        }
+        return 1;
+    }
+
+    tokens_offset = align(sizeof(tape_header) + src_stat.st_size + 1);
+    size = tokens_offset + (src_stat.st_size + 1) * sizeof(jc_token);
+
+    shm_fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0644);
+    if (shm_fd < 0) {
+        perror("Can't create shared memory segment");
+        close(src_fd);
+        return 1;
+    } else if (ftruncate(shm_fd, size) != 0) {
+        close(shm_fd);
+        return abort_publish("Can't size shared memory segment", name, src_fd,
+                             NULL, size);
+    }
+
+    header = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, shm_fd, 0);
+    close(shm_fd);
+    if (header == MAP_FAILED) {
+        return abort_publish("Can't map shared memory segment", name, src_fd,
+                             NULL, size);
+    }
+
+    memcpy(header->magic, TAPE_MAGIC, sizeof(header->magic));
+    header->version = TAPE_VERSION;
+    header->token_size = sizeof(jc_token);
+    header->source_offset = sizeof(tape_header);
+    header->source_len = src_stat.st_size;
+    header->tokens_offset = tokens_offset;
+
+    source = (char *) header + header->source_offset;
+    if (!read_fully(src_fd, source, src_stat.st_size)) {
+        return abort_publish("Can't read source file", name, src_fd, header,
+                             size);
+    }
+    close(src_fd);
+
+    jc_init_n(&jc, source, header->source_len);
+    result = jc_tokenize(&jc, (jc_token *) ((char *) header + tokens_offset),
+                         header->source_len + 1, &num_tokens);
+    header->result = result;
+    header->num_tokens = num_tokens;
+    __atomic_store_n(&header->state, TAPE_STATE_READY, __ATOMIC_RELEASE);
+
+    printf("Published %lu tokens of %lu bytes as %s, result 0x%03X\n",
+            header->num_tokens, header->source_len, name, result);
+    munmap(header, size);
+    return result == JC_RESULT_OK ? 0 : 1;
+}
+
+/*
+ * Waits until the publisher has sized the segment and stored READY into its
+ * header. Until then the segment may still be empty, so only the header is
+ * mapped, and only once it exists. Returns 0 on failure or timeout.
+ */
+int wait_until_ready(int shm_fd)
+{
+    struct timespec delay = { 0, 1000000 };
+    struct stat shm_stat;
+    tape_header const * header = NULL;
+    int waited_ms = 0;
+    int ready = 0;
+
+    while (!ready && waited_ms++ <= TAPE_READY_TIMEOUT_MS) {
+        if (fstat(shm_fd, &shm_stat) != 0) {
+            break;
+        } else if (header == NULL
+                   && (size_t) shm_stat.st_size >= sizeof(tape_header)) {
+            header = mmap(NULL, sizeof(tape_header), PROT_READ, MAP_SHARED,
+                          shm_fd, 0);
+            if (header == MAP_FAILED) {
+                return 0;
+            }
+        }
+
+        ready = header != NULL && __atomic_load_n(&header->state,
+                                                  __ATOMIC_ACQUIRE)
+                                  == TAPE_STATE_READY;
+        if (!ready) {
+            nanosleep(&delay, NULL);
+        }
+    }
+
+    if (header != NULL) {
+        munmap((void *) header, sizeof(tape_header));
+    }
+    return ready;
+}
+
+int read_tape(char const * name)
+{
+    int shm_fd = -1;
+    struct stat shm_stat;
+    tape_header const * header = NULL;
+    char const * source = NULL;
+    jc_token const * tokens = NULL;
+    size_t size = 0;
+    size_t i = 0;
+    size_t token_len = 0;
+
+    shm_fd = shm_open(name, O_RDONLY, 0);
+    if (shm_fd < 0) {
+        perror("Can't open shared memory segment");
+        return 1;
+    }
+
+    if (!wait_until_ready(shm_fd)) {
+        printf("Error: %s is not ready\n", name);
+        close(shm_fd);
+        return 1;
+    }
+
+    /* The segment has its final size once it's ready */
+    if (fstat(shm_fd, &shm_stat) != 0) {
+        perror("Can't open shared memory segment");
+        close(shm_fd);
+        return 1;
+    }
+
+    size = shm_stat.st_size;
+    header = mmap(NULL, size, PROT_READ, MAP_SHARED, shm_fd, 0);
+    close(shm_fd);
+    if (header == MAP_FAILED) {
+        perror("Can't map shared memory segment");
+        return 1;
+    }
+
+    if (memcmp(header->magic, TAPE_MAGIC, sizeof(header->magic)) != 0
+            || header->version != TAPE_VERSION
+            || header->token_size != sizeof(jc_token)
+            || header->source_offset > size
+            || header->source_len > size - header->source_offset
+            || header->tokens_offset > size
+            || header->num_tokens > (size - header->tokens_offset)
+                                    / sizeof(jc_token)) {
+        printf("Error: %s is not a compatible token tape\n", name);
+        munmap((void *) header, size);
+        return 1;
+    }
+
+    source = (char const *) header + header->source_offset;
+    tokens = (jc_token const *) ((char const *) header
+                                 + header->tokens_offset);
+    for (i = 0; i < header->num_tokens; ++i) {
+        token_len = tokens[i].end - tokens[i].start;
+        printf("Token %02lu of type 0x%03X @ (%02lu, %02lu) [ %.*s ]\n",
+                (unsigned long) i, tokens[i].type,
+                (unsigned long) tokens[i].start, (unsigned long) tokens[i].end,
+                (int) (token_len > 64 ? 64 : token_len),
+                source + tokens[i].start);
+    }
+
+    if (header->result != JC_RESULT_OK) {
+        printf("Error: 0x%03lX\n", header->result);
+    }
+
+    munmap((void *) header, size);
+    return 0;
+}
+
+int main(int argc, char const * argv[])
+{
+    if (argc == 4 && strcmp(argv[1], "publish") == 0) {
+        return publish(argv[2], argv[3]);
+    } else if (argc == 3 && strcmp(argv[1], "read") == 0) {
+        return read_tape(argv[2]);
+    } else if (argc == 3 && strcmp(argv[1], "unlink") == 0) {
+        return shm_unlink(argv[2]) == 0 ? 0 : 1;
+    }
+
+    print_usage();
+    return 0;
+}
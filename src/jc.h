@@ -39,6 +39,7 @@ extern "C" {
 #include <stddef.h>
 #include <ctype.h>
 #include <string.h>
+#include <limits.h>
 
 /*
  * Max level of object and array nesting supported
@@ -50,12 +51,53 @@ extern "C" {
 #define JC_MAX_NESTING_LEVEL 8
 #endif
 
+/*
+ * Max number of characters `jc_init_at` scans backwards from the start offset
+ * to guess whether the offset is inside of a string, and the number of tokens
+ * it fetches to verify the guess.
+ */
+#ifndef JC_RESYNC_WINDOW
+#define JC_RESYNC_WINDOW 256
+#endif
+
+#ifndef JC_RESYNC_VERIFY_TOKENS
+#define JC_RESYNC_VERIFY_TOKENS 8
+#endif
+
+/*
+ * If defined, every state is initialized in trusted input mode, see
+ * `jc_set_trusted_input`.
+ *
+ * #define JC_TRUSTED_INPUT
+ */
+
+/*
+ * If defined, states keep track of the path of the current token, see
+ * `jc_path_hash` and `jc_current_path`. Otherwise tracking costs nothing.
+ *
+ * #define JC_PATH_TRACKING
+ */
+
+/*
+ * Number of slots in a set of the parse cache. A cached document may only be
+ * stored in the slots of the set selected by its hash, so lookups check at most
+ * this many slots.
+ */
+#ifndef JC_CACHE_WAYS
+#define JC_CACHE_WAYS 4
+#endif
+
 /*
  * All available jc token types.
  * They mostly correspond to `value` forms of JSON grammar, except that:
  * - `object` and `array` forms split into start/end tokens to keep them atomic
  * - `field_name` token is introduced; it's a `string` form that is placed right
  *   after `object_start` or `comma` if current nesting is in object.
+ *
+ * A reader state (see `jc_init_reader`) may return a `string`, `field_name` or
+ * `number` token that doesn't fit into its source window as a sequence of
+ * parts: every part has its type combined with JC_TOKEN_FLAG_PART, and the
+ * final one with JC_TOKEN_FLAG_LAST as well. The final part may be empty.
  */
 typedef enum {
     JC_TOKEN_TYPE_NUMBER        = 0x001,
@@ -69,7 +111,9 @@ typedef enum {
     JC_TOKEN_TYPE_OBJECT_END    = 0x100,
     JC_TOKEN_TYPE_FIELD_NAME    = 0x200,
     JC_TOKEN_TYPE_COMMA         = 0x400,
-    JC_TOKEN_TYPE_COLON         = 0x800
+    JC_TOKEN_TYPE_COLON         = 0x800,
+    JC_TOKEN_FLAG_PART          = 0x1000,
+    JC_TOKEN_FLAG_LAST          = 0x2000
 } jc_token_type;
 
 /*
@@ -95,21 +139,375 @@ typedef enum {
     JC_RESULT_ERR_UNEXPECTED_EOF        = 0x010,
     JC_RESULT_ERR_GARBAGE               = 0x020,
     JC_RESULT_ERR_MAX_NESTING_REACHED   = 0x040,
-    JC_RESULT_ERR_CORRUPTED_STATE       = 0x080
+    JC_RESULT_ERR_CORRUPTED_STATE       = 0x080,
+    JC_RESULT_ERR_BUFFER_FULL           = 0x100
 } jc_result;
 
+/*
+ * Describes one source document of a batch: a pointer to its first character
+ * and its length. Documents don't have to be null-terminated.
+ */
+typedef struct {
+    char const * source;
+    size_t len;
+} jc_document;
+
+/*
+ * Describes where tokens of one document of a batch were stored in the shared
+ * token buffer, and how tokenizing of the document ended.
+ */
+typedef struct {
+    size_t first_token;
+    size_t num_tokens;
+    jc_result result;
+} jc_document_tokens;
+
+/*
+ * Tells `jc_init_at` whether its start offset is known to be inside or outside
+ * of a string, or whether it has to be guessed.
+ */
+typedef enum {
+    JC_OFFSET_HINT_NONE,
+    JC_OFFSET_HINT_OUTSIDE_STRING,
+    JC_OFFSET_HINT_INSIDE_STRING
+} jc_offset_hint;
+
+/*
+ * Describes one segment of a source that is scattered over many buffers.
+ * Its layout matches POSIX `struct iovec`, so an array of iovecs may be passed
+ * where an array of segments is expected.
+ */
+typedef struct {
+    char const * data;
+    size_t len;
+} jc_segment;
+
 typedef struct jc_state_s jc_state;
 
+/*
+ * Function that reads up to `size` characters of source into `buffer` for
+ * a reader state, and returns the number of characters read. Returning 0 means
+ * that the source has ended.
+ */
+typedef size_t (*jc_refill_fn)(void * ctx, char * buffer, size_t size);
+
+/*
+ * How `jc_sampler` selects records: every Kth one, or every one with given
+ * probability using a seeded pseudo-random generator
+ */
+typedef enum {
+    JC_SAMPLE_EVERY_KTH,
+    JC_SAMPLE_FRACTION
+} jc_sample_mode;
+
+/*
+ * Iterates over a sample of records of an NDJSON source. Skipped records only
+ * cost a search for the newline that ends them.
+ */
+typedef struct {
+    char const * source;
+    size_t len;
+    size_t pos;
+    size_t record_index;
+    jc_sample_mode mode;
+    size_t every_kth;
+    unsigned long threshold;
+    unsigned long random;
+} jc_sampler;
+
+/*
+ * Absolute offset of every Nth record of a record index, and the position of
+ * the deltas of the records that follow it
+ */
+typedef struct {
+    size_t offset;
+    size_t delta_pos;
+} jc_record_checkpoint;
+
+/*
+ * Compact index of the start offsets of records of an NDJSON source. Every
+ * `interval`th record start is stored as a checkpoint, and the starts of the
+ * records in between as varint-encoded deltas from their predecessors, so the
+ * index takes about a byte or two per record and finding a record decodes at
+ * most `interval - 1` deltas.
+ *
+ * Both arrays are supplied by the caller, and may be replaced by larger copies
+ * when they get full; the index may also be persisted and restored by storing
+ * the used parts of both arrays together with the counters.
+ */
+typedef struct {
+    jc_record_checkpoint * checkpoints;
+    size_t max_checkpoints;
+    size_t num_checkpoints;
+    unsigned char * deltas;
+    size_t deltas_size;
+    size_t deltas_len;
+    size_t interval;
+    size_t num_records;
+    size_t last_offset;
+} jc_record_index;
+
+/*
+ * Function that receives a scalar value flattened by `jc_flatten` with its
+ * null-terminated path of given length, and returns 0 to stop flattening
+ */
+typedef int (*jc_flatten_fn)(void * ctx, char const * path, size_t path_len,
+                             jc_token const * value);
+
+/*
+ * Function that locks or unlocks a lock of a parse cache shard
+ */
+typedef void (*jc_lock_fn)(void * lock);
+
+typedef struct jc_cache_shard_s jc_cache_shard;
+
+/*
+ * Parse cache that stores token tapes of recently tokenized documents in
+ * a caller-supplied arena, so that repeated documents are not tokenized again.
+ *
+ * The arena is split into shards, and every shard into fixed-size slots that
+ * hold a document copy together with its tokens. Documents are looked up by
+ * hash, length and contents; the least recently used slot of a set is evicted
+ * to store a new document. If locks are set, every shard is protected by its
+ * own lock and the cache may be used from many threads.
+ */
+typedef struct {
+    jc_cache_shard * shards;
+    size_t num_shards;
+    size_t num_sets;
+    size_t slot_size;
+    jc_lock_fn lock;
+    jc_lock_fn unlock;
+} jc_cache;
+
+/*
+ * String of a dictionary: its position in the string area, length and hash
+ */
+typedef struct {
+    size_t offset;
+    size_t len;
+    unsigned long hash;
+} jc_dict_entry;
+
+/*
+ * Dictionary that interns strings, e.g. values of low-cardinality fields, and
+ * encodes them as small integer codes, so that repeated values can be stored,
+ * compared and grouped as integers. Codes are assigned from 0 in order of
+ * first appearance.
+ *
+ * Entries, an open-addressing hash table of codes and the interned strings
+ * live in a caller-supplied arena of fixed size; every distinct string is
+ * copied into it once, and strings that don't fit anymore are not interned.
+ */
+typedef struct {
+    jc_dict_entry * entries;
+    size_t max_entries;
+    size_t num_entries;
+    size_t * slots;
+    size_t num_slots;
+    char * strings;
+    size_t strings_size;
+    size_t strings_len;
+} jc_dict;
+
+/*
+ * Position of every Nth token of a packed tape: the end of the token before
+ * it, which its start is relative to, and the position of its first varint
+ */
+typedef struct {
+    size_t base;
+    size_t data_pos;
+} jc_packed_checkpoint;
+
+/*
+ * Compressed token tape. Token types are stored as 4-bit codes, two per byte,
+ * and positions as varints in a separate data array: the distance from the end
+ * of the previous token to the start of the token, followed by its length for
+ * numbers, strings and field names only, since other tokens have fixed lengths.
+ * Both mostly fit into a byte, so a token takes about one to three bytes
+ * instead of a whole jc_token. Every `interval`th token is stored as
+ * a checkpoint, so seeking to a token decodes at most `interval - 1` others.
+ *
+ * All arrays are supplied by the caller, and may be replaced by larger copies
+ * when they get full.
+ */
+typedef struct {
+    unsigned char * types;
+    size_t types_size;
+    unsigned char * data;
+    size_t data_size;
+    size_t data_len;
+    jc_packed_checkpoint * checkpoints;
+    size_t max_checkpoints;
+    size_t num_checkpoints;
+    size_t interval;
+    size_t num_tokens;
+    size_t last_end;
+} jc_packed_tape;
+
+/*
+ * Position of a sequential reader of a packed tape
+ */
+typedef struct {
+    jc_packed_tape const * tape;
+    size_t token;
+    size_t data_pos;
+    size_t last_end;
+} jc_packed_reader;
+
+/*
+ * Slot of a member index: hash of a field name and the tape position of the
+ * field name plus one, or 0 if the slot is empty
+ */
+typedef struct {
+    unsigned long hash;
+    size_t member;
+} jc_tape_slot;
+
+/*
+ * Object of a tape that was looked up: its tape position plus one (or 0 if
+ * the record is unused), the number of lookups, and its member index once
+ * it's built
+ */
+typedef struct {
+    size_t object;
+    unsigned long num_lookups;
+    size_t first_slot;
+    size_t num_slots;
+    int status;
+} jc_tape_object;
+
+/*
+ * Member lookups in objects of a token tape, i.e. an array of tokens of a whole
+ * document as stored by `jc_tokenize`. A lookup scans the members of an object
+ * linearly, but once an object was looked up more than `threshold` times and
+ * has at least `min_members` members, a hash index of its members is built and
+ * used for all later lookups in it.
+ *
+ * Looked up objects are recorded in a caller-supplied hash table of object
+ * records, and member indexes are allocated from a caller-supplied array of
+ * slots. Objects that don't fit into either are always scanned.
+ */
+typedef struct {
+    char const * source;
+    jc_token const * tokens;
+    size_t num_tokens;
+    jc_tape_object * objects;
+    size_t max_objects;
+    size_t num_objects;
+    jc_tape_slot * slots;
+    size_t max_slots;
+    size_t num_slots;
+    size_t min_members;
+    unsigned long threshold;
+} jc_tape_index;
+
 /*
  * Given a jc_state structure and null-terminated ASCII-encoded source JSON
  * string, initializes the state structure.
  *
+ * If this or any other init function fails, a non-null state is still
+ * initialized, as an empty source that has no tokens.
+ *
  * Returns:
  *  - JC_RESULT_OK if everything went fine
  *  - JC_RESULT_ERR_CANT_INIT if `state` or `source` is null
  */
 jc_result jc_init(jc_state * state, char const * const source);
 
+/*
+ * Same as `jc_init`, but the source string is given by its length and does
+ * not have to be null-terminated. Tokenizing stops at the first null character
+ * or after `len` characters, whichever comes first.
+ */
+jc_result jc_init_n(jc_state * state, char const * const source, size_t len);
+
+/*
+ * Same as `jc_init_n`, but tokenizes only the part of the source string from
+ * `start` to `end` position. Token positions are still relative to `source`.
+ */
+jc_result jc_init_span(jc_state * state, char const * const source,
+                       size_t start, size_t end);
+
+/*
+ * Same as `jc_init_n`, but starts tokenizing at an arbitrary `offset` in the
+ * middle of the source, e.g. at a split point of a document processed in
+ * parallel or at the start of a byte range read.
+ *
+ * Unless `hint` tells, whether the offset is inside of a string is guessed from
+ * the context of the closest double quote within JC_RESYNC_WINDOW characters
+ * before the offset, and the guess is verified by tokenizing ahead. Then the
+ * state is moved to the closest point after which the grammar is known: after
+ * a comma or colon, or at a bracket. Tokenizing continues from there with
+ * nesting levels relative to the enclosing object or array. Whether it's an
+ * object or array is inferred from the tokens that follow, and closing it
+ * moves to its (equally unknown) parent instead of ending the document. The end
+ * of source between tokens is reported as JC_RESULT_EOF.
+ *
+ * Returns:
+ *  - JC_RESULT_OK if everything went fine
+ *  - JC_RESULT_ERR_CANT_INIT if `state` or `source` is null, `offset` is past
+ *      the end of source, or no point to continue tokenizing from was found
+ */
+jc_result jc_init_at(jc_state * state, char const * const source, size_t len,
+                     size_t offset, jc_offset_hint hint);
+
+/*
+ * Given a jc_state structure, the source string and a `string` token obtained
+ * from it, initializes the state to tokenize the JSON document that is stored
+ * escaped inside of that string, e.g. '"{\"a\": 1}"'.
+ *
+ * Escape sequences are decoded on the fly while scanning, so no unescaped copy
+ * is made. Start and end positions of inner tokens are reported relative to
+ * `source`, i.e. they point into the escaped representation; inner `string`
+ * tokens thus still have to be unescaped twice by the caller.
+ *
+ * Returns:
+ *  - JC_RESULT_OK if everything went fine
+ *  - JC_RESULT_ERR_CANT_INIT if `state`, `source` or `token` is null, or if
+ *      `token` is not a `string` token
+ */
+jc_result jc_init_nested(jc_state * state, char const * const source,
+                         jc_token const * token);
+
+/*
+ * Initializes the state to pull the source through a fixed `window` buffer of
+ * `window_size` characters, which is filled by calling `refill` with `ctx`
+ * whenever the tokenizer runs out of characters. Memory use thus doesn't depend
+ * on the length of source or of its tokens: strings and numbers longer than
+ * the window are returned in parts (see `jc_token_type`).
+ *
+ * Token positions are offsets from the start of source. Since the window moves,
+ * token contents must be obtained with `jc_token_data`, and they stay valid
+ * only until the next token is fetched or peeked. Functions that look ahead
+ * without fetching tokens, like `jc_count_elements`, see the window only.
+ *
+ * Returns:
+ *  - JC_RESULT_OK if everything went fine
+ *  - JC_RESULT_ERR_CANT_INIT if `state`, `window` or `refill` is null, or
+ *      `window_size` is less than 8
+ */
+jc_result jc_init_reader(jc_state * state, char * window, size_t window_size,
+                         jc_refill_fn refill, void * ctx);
+
+/*
+ * Initializes the state to tokenize a source that is the concatenation of
+ * `num_segments` segments, e.g. a chain of network buffers, without copying
+ * them into one buffer. Segments may be empty, but the data of the first one
+ * must not be null.
+ *
+ * Token positions are offsets from the start of the first segment; use
+ * `jc_locate` to find the segment and offset of a position, and
+ * `jc_token_parts` to get the contents of a token that spans segments.
+ *
+ * Returns:
+ *  - JC_RESULT_OK if everything went fine
+ *  - JC_RESULT_ERR_CANT_INIT if `state` or `segments` is null, or there are no
+ *      segments
+ */
+jc_result jc_init_iov(jc_state * state, jc_segment const * segments,
+                      size_t num_segments);
+
 /*
  * Given a state and token objects, parses the next token from the source string
  * set by `jc_init` into the token object if it is supplied, and returns result
@@ -129,355 +527,3556 @@ jc_result jc_init(jc_state * state, char const * const source);
  */
 jc_result jc_next_token(jc_state * state, jc_token * token);
 
-/* --- Move along sir. This is private property. --- */
+/*
+ * Same as `jc_next_token`, but does not consume the token: the following call
+ * of `jc_next_token` returns the same token and result without scanning the
+ * source again. Repeated peeks return the same token.
+ */
+jc_result jc_peek_token(jc_state * state, jc_token * token);
 
-#define JC_NO_TOKENS_EXPECTED   (0)
-#define JC_NO_NESTING_LEVEL     (-1)
+/*
+ * Returns a pointer to the first character of a token fetched from the state.
+ * It's the same as `source + token->start`, except for reader and segmented
+ * states. Contents of a token of a segmented state are contiguous only if the
+ * token doesn't span segments, see `jc_token_parts`.
+ */
+char const * jc_token_data(jc_state const * state, jc_token const * token);
 
-#define JC_TOKEN_TYPE_VALUE \
-    ( JC_TOKEN_TYPE_NUMBER \
-    | JC_TOKEN_TYPE_STRING \
-    | JC_TOKEN_TYPE_TRUE \
-    | JC_TOKEN_TYPE_FALSE \
-    | JC_TOKEN_TYPE_NULL \
-    | JC_TOKEN_TYPE_ARRAY_START \
-    | JC_TOKEN_TYPE_OBJECT_START \
-    )
+/*
+ * Given a position in the source of a segmented state, stores the index of
+ * the segment it's in and its offset in that segment. For other states, the
+ * segment is 0 and the offset is the position itself.
+ *
+ * Returns 1 if the position is inside of the source, 0 otherwise.
+ */
+int jc_locate(jc_state const * state, size_t pos, size_t * segment,
+              size_t * offset);
 
-#define JC_CHAR_NULL            '\0'
-#define JC_CHAR_OBJECT_START    '{'
-#define JC_CHAR_OBJECT_END      '}'
-#define JC_CHAR_ARRAY_START     '['
-#define JC_CHAR_ARRAY_END       ']'
-#define JC_CHAR_COMMA           ','
-#define JC_CHAR_COLON           ':'
-#define JC_CHAR_DQUOTE          '"'
-#define JC_CHAR_BACKSLASH       '\\'
+/*
+ * Stores the contiguous pieces of the contents of a token fetched from the
+ * state into `parts`, which can hold up to `max_parts` pieces, and returns
+ * their number. Only a token of a segmented state may have many pieces; an
+ * empty token has none.
+ */
+size_t jc_token_parts(jc_state const * state, jc_token const * token,
+                      jc_segment * parts, size_t max_parts);
 
-#define JC_LIT_TRUE     "true"
-#define JC_LIT_FALSE    "false"
-#define JC_LIT_NULL     "null"
+/*
+ * Given the contents of a `number` token and their length, stores the integer
+ * they represent into `value`.
+ *
+ * Returns:
+ *  - JC_RESULT_OK if everything went fine
+ *  - JC_RESULT_ERR_UNEXPECTED_TOKEN if the number has a fraction or exponent,
+ *      isn't a number at all, or doesn't fit into a long
+ */
+jc_result jc_decode_integer(char const * data, size_t len, long * value);
 
-#define JC_VALID_CHARS_IN_NUMBER "0123456789-+eE."
+/*
+ * Given the contents of a `string` or `field_name` token and their length,
+ * stores them with escape sequences decoded into `buffer` of given size,
+ * terminated by a null character, and their decoded length into `len`.
+ * Unicode escapes are encoded as UTF-8, and escaped surrogate pairs are
+ * combined.
+ *
+ * Returns:
+ *  - JC_RESULT_OK if everything went fine
+ *  - JC_RESULT_ERR_BUFFER_FULL if the decoded string doesn't fit; as much of
+ *      it as fits is stored, still terminated
+ *  - JC_RESULT_ERR_UNEXPECTED_TOKEN if an escape sequence is invalid or
+ *      truncated, or a surrogate isn't paired
+ */
+jc_result jc_decode_string(char const * data, size_t len, char * buffer,
+                           size_t size, size_t * decoded_len);
 
-typedef enum {
-    JC_NESTING_TYPE_OBJECT,
-    JC_NESTING_TYPE_ARRAY
-} jc_nesting_type;
+#ifdef JC_PATH_TRACKING
 
-struct jc_state_s {
-    char const * source;
-    size_t source_pos;
-    jc_nesting_type nesting_stack[JC_MAX_NESTING_LEVEL];
-    int nesting_level;
-    size_t expected_token_types;
-};
+/*
+ * Returns the hash of the path of the last token fetched or peeked from the
+ * state, which is the same as the `jc_pointer_hash` of its JSON Pointer. The
+ * path of a value, field name or colon leads to the value; the path of
+ * a comma or an object or array end leads to the enclosing object or array.
+ * Field names are hashed as they appear in source, i.e. escaped.
+ */
+unsigned long jc_path_hash(jc_state const * state);
+
+/*
+ * Stores the JSON Pointer of the path of the last token fetched or peeked
+ * from the state, e.g. "/items/0/id", into `buffer` of given size as
+ * a null-terminated string.
+ *
+ * Returns:
+ *  - JC_RESULT_OK if everything went fine
+ *  - JC_RESULT_ERR_BUFFER_FULL if the buffer is too small
+ *  - JC_RESULT_ERR_CANT_INIT if it's a reader state, which doesn't keep the
+ *      field names of the path
+ */
+jc_result jc_current_path(jc_state * state, char * buffer, size_t size);
+
+/*
+ * Returns the hash of a null-terminated JSON Pointer, to be compared with
+ * `jc_path_hash`. It's a hash of path components, each preceded by a null
+ * character, with "~0" and "~1" decoded.
+ */
+unsigned long jc_pointer_hash(char const * pointer);
+
+/*
+ * Returns the number of components of a null-terminated JSON Pointer. Passed
+ * to `jc_set_max_emit_depth`, it skips everything nested deeper than values
+ * under the pointer.
+ */
+int jc_pointer_depth(char const * pointer);
+
+/*
+ * Fetches tokens from the state until the first number, string, true, false
+ * or null token with given path hash, e.g. from `jc_pointer_hash`, and stores
+ * it into `value`. Objects and arrays under the path are not values.
+ *
+ * Returns:
+ *  - JC_RESULT_OK if the value was found
+ *  - JC_RESULT_EOF if the source ended without it
+ *  - any error code that `jc_next_token` may return
+ */
+jc_result jc_find_path_value(jc_state * state, unsigned long path_hash,
+                             jc_token * value);
+
+#endif
+
+/*
+ * Given a state inside of an array or object, stores the number of its
+ * elements (or fields) that were not started yet into `count`. Nothing is
+ * tokenized and the state is left unchanged.
+ *
+ * Returns:
+ *  - JC_RESULT_OK if everything went fine
+ *  - JC_RESULT_ERR_UNEXPECTED_TOKEN if the state is not inside of an array or
+ *      object, a token was peeked and not consumed yet, or only some parts of
+ *      the current token were fetched
+ *  - JC_RESULT_ERR_UNEXPECTED_EOF if the source ended before the array or
+ *      object did
+ */
+jc_result jc_count_elements(jc_state * state, size_t * count);
+
+/*
+ * Given a state inside of an array or object, makes the next `jc_next_token`
+ * skip the rest of its contents and return its end token. Called right after
+ * its start token, it skips the whole array or object. Skipped contents are
+ * not tokenized, only brackets are counted.
+ *
+ * Returns:
+ *  - JC_RESULT_OK if everything went fine
+ *  - JC_RESULT_ERR_UNEXPECTED_TOKEN if the state is not inside of an array or
+ *      object, a token was peeked and not consumed yet, or only some parts of
+ *      the current token were fetched
+ */
+jc_result jc_skip_container(jc_state * state);
+
+/*
+ * Fetches the next value from the state with all of its contents, and passes
+ * every scalar value in it to `callback` along with its path relative to that
+ * value: field names joined by dots and array indices in brackets, e.g.
+ * "a.b[3].c". A scalar fetched on its own has an empty path. The path is kept
+ * in `path` of given size and only truncated and extended as nesting changes,
+ * so nothing is built per value. Field names are copied as they appear in
+ * source, i.e. escaped.
+ *
+ * Returns:
+ *  - JC_RESULT_OK if everything went fine or the callback stopped flattening
+ *  - JC_RESULT_ERR_BUFFER_FULL if a path doesn't fit into the buffer
+ *  - JC_RESULT_ERR_CANT_INIT if it's a reader state, which doesn't keep the
+ *      field names of the path
+ *  - JC_RESULT_ERR_UNEXPECTED_TOKEN if the next token doesn't start a value
+ *  - any other result of `jc_next_token` that is not JC_RESULT_OK
+ */
+jc_result jc_flatten(jc_state * state, char * path, size_t size,
+                     jc_flatten_fn callback, void * ctx);
+
+/*
+ * Makes `jc_next_token` skip all tokens nested deeper than `depth`, e.g. with
+ * depth 1 only the top-level tokens are returned. An object or array at that
+ * depth is returned as its start and end tokens only; its contents are skipped
+ * by counting brackets, without tokenizing. A negative depth turns it off.
+ */
+void jc_set_max_emit_depth(jc_state * state, int depth);
+
+/*
+ * Turns trusted input mode on or off. It's meant for JSON that is known to be
+ * valid, e.g. produced by own serializers: the type of every token is inferred
+ * from its first character and the nesting stack alone, skipping the checks of
+ * expected token types. Tokens of malformed input are undefined in this mode,
+ * but they stay within the source, and nesting is still bounded by
+ * JC_MAX_NESTING_LEVEL.
+ *
+ * Trusted input mode is on by default if JC_TRUSTED_INPUT is defined.
+ */
+void jc_set_trusted_input(jc_state * state, int trusted);
+
+/*
+ * Given an initialized state, fetches all remaining tokens of the source string
+ * into the `tokens` buffer which can hold up to `max_tokens` tokens, and stores
+ * the number of fetched tokens into `num_tokens`.
+ *
+ * Returns:
+ *  - JC_RESULT_OK if the whole source string was tokenized
+ *  - JC_RESULT_ERR_BUFFER_FULL if the source string has more than `max_tokens`
+ *      tokens left; the state is then positioned after the last stored token
+ *  - any error code that `jc_next_token` may return
+ */
+jc_result jc_tokenize(jc_state * state, jc_token * tokens, size_t max_tokens,
+                      size_t * num_tokens);
+
+/*
+ * Tokenizes a batch of `num_documents` documents into the shared `tokens`
+ * buffer which can hold up to `max_tokens` tokens. Tokens of every document
+ * are stored contiguously, and their range and the tokenizing result is stored
+ * into the corresponding element of `ranges`. Token positions are relative to
+ * the start of their document.
+ *
+ * Every document is tokenized as with `jc_init_n` and `jc_tokenize`, so a batch
+ * is not faster than tokenizing its documents one by one; it saves keeping
+ * track of where the tokens of each document are.
+ *
+ * Returns the number of documents processed. It is less than `num_documents`
+ * only if the token buffer got full; the range of the last processed document
+ * then has JC_RESULT_ERR_BUFFER_FULL result, and the batch may be resumed from
+ * that document with a fresh buffer.
+ */
+size_t jc_tokenize_batch(jc_document const * documents, size_t num_documents,
+                         jc_token * tokens, size_t max_tokens,
+                         jc_document_tokens * ranges);
+
+/*
+ * Given an NDJSON source of given length, returns the position of the newline
+ * that ends the record starting at `pos`, or `len` if the record is the last
+ * one. Newlines inside of strings don't end records.
+ */
+size_t jc_find_record_end(char const * source, size_t len, size_t pos);
+
+/*
+ * Returns the number of records in an NDJSON source of given length. Blank
+ * lines are not counted.
+ */
+size_t jc_count_records(char const * source, size_t len);
+
+/*
+ * Finds the next NDJSON record of a source of given length at or after `*pos`,
+ * skipping blank lines, stores where it starts and ends into `start` and `end`,
+ * and moves `*pos` past it. Leading whitespace is not part of the record, and
+ * records end as in `jc_find_record_end`.
+ *
+ * Returns 1 if a record was found, 0 if there are no more records.
+ */
+int jc_next_record(char const * source, size_t len, size_t * pos,
+                   size_t * start, size_t * end);
+
+/*
+ * Given a source string of given length that ends with a JSON array, finds up
+ * to `max_elements` of its last elements by scanning backwards from the end,
+ * and stores them in source order into `elements` and their number into
+ * `num_elements`. An element token spans the whole value and has the type of
+ * its first token. The array may be unclosed or end with a comma, e.g. if it's
+ * the tail of a growing log.
+ *
+ * Returns:
+ *  - JC_RESULT_OK if everything went fine
+ *  - JC_RESULT_ERR_UNEXPECTED_TOKEN if an element is empty or unbalanced
+ *  - JC_RESULT_ERR_UNEXPECTED_EOF if the start of source was reached before
+ *      the start of the array; found elements are still stored
+ */
+jc_result jc_find_last_elements(char const * source, size_t len,
+                                jc_token * elements, size_t max_elements,
+                                size_t * num_elements);
+
+/*
+ * Initializes a sampler over an NDJSON source of given length that selects
+ * every `k`th record, starting with the first one.
+ */
+void jc_sampler_init_every(jc_sampler * sampler, char const * source,
+                           size_t len, size_t k);
+
+/*
+ * Initializes a sampler over an NDJSON source of given length that selects
+ * every record with probability `fraction`. The same seed selects the same
+ * records.
+ */
+void jc_sampler_init_fraction(jc_sampler * sampler, char const * source,
+                              size_t len, double fraction, unsigned long seed);
+
+/*
+ * Moves the sampler to the next selected record, initializes `state` to
+ * tokenize it, and stores its zero-based index among all records into
+ * `record_index` if it is supplied.
+ *
+ * Returns:
+ *  - JC_RESULT_OK if a record was selected
+ *  - JC_RESULT_EOF if no records are left
+ */
+jc_result jc_sampler_next(jc_sampler * sampler, jc_state * state,
+                          size_t * record_index);
+
+/*
+ * Selects a uniform random sample of up to `k` records of an NDJSON source of
+ * given length in a single pass, and stores their spans into `records` (which
+ * must hold `k` tokens) in no particular order. The same seed selects the same
+ * records.
+ *
+ * Returns the number of stored records.
+ */
+size_t jc_sample_reservoir(char const * source, size_t len, size_t k,
+                           unsigned long seed, jc_token * records);
+
+/*
+ * Initializes an empty record index with a checkpoint every `interval` records,
+ * using given checkpoint and delta arrays.
+ */
+void jc_record_index_init(jc_record_index * index,
+                          jc_record_checkpoint * checkpoints,
+                          size_t max_checkpoints, unsigned char * deltas,
+                          size_t deltas_size, size_t interval);
+
+/*
+ * Appends a record starting at `offset`, which must not be less than the start
+ * of the last record, to the index.
+ *
+ * Returns:
+ *  - JC_RESULT_OK if everything went fine
+ *  - JC_RESULT_ERR_BUFFER_FULL if the checkpoint or delta array is full; the
+ *      index is unchanged
+ */
+jc_result jc_record_index_add(jc_record_index * index, size_t offset);
+
+/*
+ * Appends all records of an NDJSON source of given length to the index,
+ * continuing after the last indexed record if there is one. A record starts at
+ * its first non-whitespace character, and ends at the position returned by
+ * `jc_find_record_end`.
+ *
+ * Returns:
+ *  - JC_RESULT_OK if everything went fine
+ *  - JC_RESULT_ERR_BUFFER_FULL if an array got full; the build may be
+ *      continued by calling this function again after replacing it
+ */
+jc_result jc_record_index_build(jc_record_index * index, char const * source,
+                                size_t len);
+
+/*
+ * Stores the start offset of the record with given zero-based index into
+ * `offset`.
+ *
+ * Returns:
+ *  - JC_RESULT_OK if everything went fine
+ *  - JC_RESULT_EOF if there's no such record
+ *  - JC_RESULT_ERR_CORRUPTED_STATE if the deltas of the record are truncated
+ */
+jc_result jc_record_index_get(jc_record_index const * index, size_t record,
+                              size_t * offset);
+
+/*
+ * Given a hash of preceding data (or JC_HASH_INIT) and a data buffer, returns
+ * the hash of their concatenation. It's a 32-bit FNV-1a hash, so its values do
+ * not depend on the platform.
+ */
+unsigned long jc_hash(unsigned long hash, char const * data, size_t len);
+
+/*
+ * Mixes all bits of a 32-bit hash into its low bits, which is what hash
+ * tables and filters that select slots by the low bits need: low bits of
+ * FNV-1a hashes only depend on low bits of their input.
+ */
+unsigned long jc_mix_hash(unsigned long hash);
+
+/*
+ * Initializes a parse cache with `num_shards` shard structures and an arena of
+ * `arena_size` bytes aligned for jc_token. The arena is split into slots of
+ * `slot_size` bytes; a document is cached only if a slot can hold it and its
+ * tokens.
+ *
+ * Returns:
+ *  - JC_RESULT_OK if everything went fine
+ *  - JC_RESULT_ERR_CANT_INIT if any pointer is null or the arena is too small
+ *      for one set of slots per shard
+ */
+jc_result jc_cache_init(jc_cache * cache, jc_cache_shard * shards,
+                        size_t num_shards, void * arena, size_t arena_size,
+                        size_t slot_size);
+
+/*
+ * Makes the cache thread-safe: shard N is protected by a lock at
+ * `locks + N * lock_size`, which is locked and unlocked with given functions.
+ */
+void jc_cache_set_locks(jc_cache * cache, jc_lock_fn lock, jc_lock_fn unlock,
+                        void * locks, size_t lock_size);
+
+/*
+ * Same as `jc_tokenize` for a whole source string of given length, but looks
+ * the source up in the cache first. On a hit, cached tokens are copied into
+ * `tokens`; on a miss, the source is tokenized and stored in the cache if it
+ * was tokenized successfully.
+ */
+jc_result jc_cache_tokenize(jc_cache * cache, char const * source, size_t len,
+                            jc_token * tokens, size_t max_tokens,
+                            size_t * num_tokens);
+
+/*
+ * Stores the total number of cache hits and misses.
+ */
+void jc_cache_stats(jc_cache * cache, unsigned long * hits,
+                    unsigned long * misses);
+
+/*
+ * Initializes a dictionary of at most `max_entries` strings in an arena of
+ * `arena_size` bytes aligned for size_t. Entries and the hash table take
+ * a fixed part of the arena, and interned strings the rest.
+ *
+ * Returns:
+ *  - JC_RESULT_OK if everything went fine
+ *  - JC_RESULT_ERR_CANT_INIT if any pointer is null, `max_entries` is 0, or the
+ *      arena leaves no room for strings
+ */
+jc_result jc_dict_init(jc_dict * dict, void * arena, size_t arena_size,
+                       size_t max_entries);
+
+/*
+ * Stores the code of a string of given length, e.g. the contents of a string
+ * token, into `code`, interning the string if it's not in the dictionary yet.
+ * Strings are compared as they are, so escaped strings should be decoded with
+ * `jc_decode_string` first if their escaping may differ.
+ *
+ * Returns:
+ *  - JC_RESULT_OK if everything went fine
+ *  - JC_RESULT_ERR_BUFFER_FULL if the string is new and there's no room for
+ *      another entry or for the string; the dictionary is unchanged
+ */
+jc_result jc_dict_encode(jc_dict * dict, char const * data, size_t len,
+                         size_t * code);
+
+/*
+ * Stores the interned string with given code and its length into `data` and
+ * `len`. The string is not null-terminated.
+ *
+ * Returns:
+ *  - JC_RESULT_OK if everything went fine
+ *  - JC_RESULT_EOF if there's no such code
+ */
+jc_result jc_dict_decode(jc_dict const * dict, size_t code, char const ** data,
+                         size_t * len);
+
+/*
+ * Initializes an empty packed tape with a type array of `types_size` bytes,
+ * which holds two tokens per byte, a data array of `data_size` bytes, and
+ * a checkpoint every `interval` tokens.
+ */
+void jc_packed_tape_init(jc_packed_tape * tape, unsigned char * types,
+                         size_t types_size, unsigned char * data,
+                         size_t data_size, jc_packed_checkpoint * checkpoints,
+                         size_t max_checkpoints, size_t interval);
+
+/*
+ * Appends a token to the tape. Tokens must be appended in source order and must
+ * not overlap, as they are fetched from a state.
+ *
+ * Returns:
+ *  - JC_RESULT_OK if everything went fine
+ *  - JC_RESULT_ERR_BUFFER_FULL if an array is full; the tape is unchanged
+ *  - JC_RESULT_ERR_UNEXPECTED_TOKEN if the token is a part, starts before the
+ *      end of the previous one, or has an unexpected length for its type
+ */
+jc_result jc_packed_tape_add(jc_packed_tape * tape, jc_token const * token);
+
+/*
+ * Positions `reader` at the token with given zero-based index of the tape, or
+ * at its end if the index equals the number of tokens.
+ *
+ * Returns:
+ *  - JC_RESULT_OK if everything went fine
+ *  - JC_RESULT_EOF if there's no such token
+ *  - JC_RESULT_ERR_CORRUPTED_STATE if the tape data is truncated
+ */
+jc_result jc_packed_tape_seek(jc_packed_tape const * tape, size_t token,
+                              jc_packed_reader * reader);
+
+/*
+ * Decodes up to `max_tokens` tokens from the position of the reader into
+ * `tokens`, stores their number into `num_tokens` and advances the reader past
+ * them. Decoding a batch at once keeps the loop tight, and single-byte varints
+ * are decoded without a call.
+ *
+ * Returns:
+ *  - JC_RESULT_OK if everything went fine
+ *  - JC_RESULT_EOF if the reader is at the end of the tape
+ *  - JC_RESULT_ERR_CORRUPTED_STATE if the tape data is truncated or invalid;
+ *      tokens decoded before are still stored
+ */
+jc_result jc_packed_tape_read(jc_packed_reader * reader, jc_token * tokens,
+                              size_t max_tokens, size_t * num_tokens);
+
+/*
+ * Initializes lookups in a token tape of the source with `max_objects` object
+ * records and `max_slots` member index slots. Indexes are built for objects
+ * with at least `min_members` members that are looked up more than
+ * `threshold` times.
+ */
+void jc_tape_index_init(jc_tape_index * index, char const * source,
+                        jc_token const * tokens, size_t num_tokens,
+                        jc_tape_object * objects, size_t max_objects,
+                        jc_tape_slot * slots, size_t max_slots,
+                        size_t min_members, unsigned long threshold);
+
+/*
+ * Finds the member with given field name in the object starting at tape
+ * position `object`, and stores the tape position of its value into `value`.
+ * Field names are compared as they appear in source, i.e. escaped; if a name
+ * appears many times, the first member is found.
+ *
+ * Returns:
+ *  - JC_RESULT_OK if everything went fine
+ *  - JC_RESULT_EOF if the object has no such member
+ *  - JC_RESULT_ERR_UNEXPECTED_TOKEN if there's no object start at `object`
+ *  - JC_RESULT_ERR_CORRUPTED_STATE if the object is truncated or malformed
+ */
+jc_result jc_tape_find_member(jc_tape_index * index, size_t object,
+                              char const * key, size_t key_len, size_t * value);
+
+/* --- Move along sir. This is private property. --- */
+
+#define JC_NO_TOKENS_EXPECTED   (0)
+#define JC_NO_NESTING_LEVEL     (-1)
+#define JC_UNBOUNDED_SOURCE_LEN ((size_t) -1)
+
+#define JC_NO_MAX_EMIT_DEPTH    (-1)
+#define JC_MIN_WINDOW_SIZE      (8)
+
+#define JC_STATE_FLAG_ESCAPED       (0x01)
+#define JC_STATE_FLAG_SKIP_CONTENTS (0x02)
+#define JC_STATE_FLAG_LOOKAHEAD     (0x04)
+#define JC_STATE_FLAG_RESYNCED      (0x08)
+#define JC_STATE_FLAG_WINDOW_FULL   (0x10)
+#define JC_STATE_FLAG_SOURCE_ENDED  (0x20)
+#define JC_STATE_FLAG_TRUSTED       (0x40)
+
+#ifdef JC_TRUSTED_INPUT
+#define JC_DEFAULT_STATE_FLAGS JC_STATE_FLAG_TRUSTED
+#else
+#define JC_DEFAULT_STATE_FLAGS 0
+#endif
+
+#define JC_TOKEN_TYPE_SCALAR \
+    ( JC_TOKEN_TYPE_NUMBER \
+    | JC_TOKEN_TYPE_STRING \
+    | JC_TOKEN_TYPE_TRUE \
+    | JC_TOKEN_TYPE_FALSE \
+    | JC_TOKEN_TYPE_NULL \
+    )
+
+#define JC_TOKEN_TYPE_VALUE \
+    ( JC_TOKEN_TYPE_NUMBER \
+    | JC_TOKEN_TYPE_STRING \
+    | JC_TOKEN_TYPE_TRUE \
+    | JC_TOKEN_TYPE_FALSE \
+    | JC_TOKEN_TYPE_NULL \
+    | JC_TOKEN_TYPE_ARRAY_START \
+    | JC_TOKEN_TYPE_OBJECT_START \
+    )
+
+#define JC_CHAR_NULL            '\0'
+#define JC_CHAR_OBJECT_START    '{'
+#define JC_CHAR_OBJECT_END      '}'
+#define JC_CHAR_ARRAY_START     '['
+#define JC_CHAR_ARRAY_END       ']'
+#define JC_CHAR_COMMA           ','
+#define JC_CHAR_COLON           ':'
+#define JC_CHAR_DQUOTE          '"'
+#define JC_CHAR_BACKSLASH       '\\'
+#define JC_CHAR_SLASH           '/'
+#define JC_CHAR_NON_ASCII       '?'
+
+#define JC_LIT_TRUE     "true"
+#define JC_LIT_FALSE    "false"
+#define JC_LIT_NULL     "null"
+
+#define JC_VALID_CHARS_IN_NUMBER "0123456789-+eE."
+
+#define JC_HASH_INIT    (2166136261UL)
+#define JC_HASH_PRIME   (16777619UL)
+#define JC_HASH_MASK    (0xFFFFFFFFUL)
+
+#define JC_MAX_VARINT_SIZE ((sizeof(size_t) * 8 + 6) / 7)
+
+/* Token types are single bits; a packed tape stores their bit numbers */
+#define JC_PACKED_TYPE_CODES 12
+
+#define JC_TAPE_OBJECT_PENDING 0
+#define JC_TAPE_OBJECT_INDEXED 1
+#define JC_TAPE_OBJECT_SCANNED 2
+
+#define JC_RANDOM_DEFAULT_SEED      (2463534242UL)
+#define JC_RANDOM_SEED_SCRAMBLER    (2654435761UL)
+
+struct jc_cache_shard_s {
+    unsigned char * slots;
+    unsigned long clock;
+    unsigned long hits;
+    unsigned long misses;
+    void * lock;
+};
+
+/* Header of a parse cache slot; tokens and the source copy follow it */
+typedef struct {
+    unsigned long hash;
+    unsigned long last_used;
+    size_t source_len;
+    size_t num_tokens;
+} jc_cache_slot;
+
+typedef enum {
+    JC_NESTING_TYPE_OBJECT,
+    JC_NESTING_TYPE_ARRAY,
+    JC_NESTING_TYPE_UNKNOWN
+} jc_nesting_type;
+
+/* Path component of a nesting level: either a field name or an index */
+typedef struct {
+    size_t key_start;
+    size_t key_end;
+    size_t index;
+    unsigned long hash;
+} jc_path_level;
+
+struct jc_state_s {
+    char const * source;
+    size_t source_base;
+    size_t source_pos;
+    size_t source_len;
+    char * window;
+    size_t window_size;
+    jc_refill_fn refill;
+    void * refill_ctx;
+    jc_segment const * segments;
+    size_t num_segments;
+    size_t segment_index;
+    jc_token_type partial_token_type;
+    unsigned int flags;
+    jc_nesting_type nesting_stack[JC_MAX_NESTING_LEVEL];
+    int nesting_level;
+    int max_emit_depth;
+    size_t expected_token_types;
+    jc_token lookahead_token;
+    jc_result lookahead_result;
+#ifdef JC_PATH_TRACKING
+    jc_path_level path_levels[JC_MAX_NESTING_LEVEL];
+    int path_depth;
+#endif
+};
+
+jc_result jc_init(jc_state * state, char const * const source)
+{
+    if (state == NULL) {
+        return JC_RESULT_ERR_CANT_INIT;
+    }
+
+    state->source = source;
+    state->source_base = 0;
+    state->source_pos = 0;
+    state->source_len = JC_UNBOUNDED_SOURCE_LEN;
+    state->window = NULL;
+    state->window_size = 0;
+    state->refill = NULL;
+    state->refill_ctx = NULL;
+    state->segments = NULL;
+    state->num_segments = 0;
+    state->segment_index = 0;
+    state->partial_token_type = JC_NO_TOKENS_EXPECTED;
+    state->flags = JC_DEFAULT_STATE_FLAGS;
+    state->nesting_level = JC_NO_NESTING_LEVEL;
+    state->max_emit_depth = JC_NO_MAX_EMIT_DEPTH;
+    state->expected_token_types = JC_TOKEN_TYPE_VALUE;
+    state->lookahead_token.type = JC_NO_TOKENS_EXPECTED;
+    state->lookahead_token.start = 0;
+    state->lookahead_token.end = 0;
+    state->lookahead_result = JC_RESULT_EOF;
+#ifdef JC_PATH_TRACKING
+    memset(state->path_levels, 0, sizeof(state->path_levels));
+    state->path_depth = 0;
+#endif
+
+    /* Without source nothing is ever read, as all positions are past its end */
+    if (source == NULL) {
+        state->source_len = 0;
+        return JC_RESULT_ERR_CANT_INIT;
+    }
+    return JC_RESULT_OK;
+}
+
+jc_result jc_init_n(jc_state * state, char const * const source, size_t len)
+{
+    if (jc_init(state, source) != JC_RESULT_OK) {
+        return JC_RESULT_ERR_CANT_INIT;
+    }
+
+    state->source_len = len;
+    return JC_RESULT_OK;
+}
+
+jc_result jc_init_span(jc_state * state, char const * const source,
+                       size_t start, size_t end)
+{
+    if (jc_init(state, source) != JC_RESULT_OK) {
+        return JC_RESULT_ERR_CANT_INIT;
+    } else if (start > end) {
+        return jc_init(state, NULL);
+    }
+
+    state->source_pos = start;
+    state->source_len = end;
+    return JC_RESULT_OK;
+}
+
+jc_result jc_init_nested(jc_state * state, char const * const source,
+                         jc_token const * token)
+{
+    if (token == NULL || token->type != JC_TOKEN_TYPE_STRING) {
+        return jc_init(state, NULL);
+    } else if (jc_init_span(state, source, token->start, token->end)
+                   != JC_RESULT_OK) {
+        return JC_RESULT_ERR_CANT_INIT;
+    }
+
+    state->flags |= JC_STATE_FLAG_ESCAPED;
+    return JC_RESULT_OK;
+}
+
+jc_result jc_init_reader(jc_state * state, char * window, size_t window_size,
+                         jc_refill_fn refill, void * ctx)
+{
+    if (refill == NULL || window_size < JC_MIN_WINDOW_SIZE) {
+        return jc_init(state, NULL);
+    } else if (jc_init(state, window) != JC_RESULT_OK) {
+        return JC_RESULT_ERR_CANT_INIT;
+    }
+
+    state->source_len = 0;
+    state->window = window;
+    state->window_size = window_size;
+    state->refill = refill;
+    state->refill_ctx = ctx;
+    return JC_RESULT_OK;
+}
+
+/*
+ * Reads source into the window of a reader state until it contains `pos`.
+ * Characters before the current source position are dropped to make room.
+ * Returns 0 if the source has ended or the window is full.
+ */
+int jc_refill(jc_state * state, size_t pos)
+{
+    size_t num_kept = state->source_len - state->source_pos;
+    size_t num_read = 0;
+
+    if (state->flags & JC_STATE_FLAG_SOURCE_ENDED) {
+        return 0;
+    }
+
+    memmove(state->window,
+            state->window + (state->source_pos - state->source_base),
+            num_kept);
+    state->source_base = state->source_pos;
+
+    while (pos >= state->source_len) {
+        if (num_kept == state->window_size) {
+            state->flags |= JC_STATE_FLAG_WINDOW_FULL;
+            return 0;
+        }
+
+        num_read = state->refill(state->refill_ctx, state->window + num_kept,
+                                 state->window_size - num_kept);
+        if (num_read == 0) {
+            state->flags |= JC_STATE_FLAG_SOURCE_ENDED;
+            return 0;
+        }
+
+        num_kept += num_read;
+        state->source_len += num_read;
+    }
+
+    return 1;
+}
+
+jc_result jc_init_iov(jc_state * state, jc_segment const * segments,
+                      size_t num_segments)
+{
+    if (segments == NULL || num_segments == 0) {
+        return jc_init(state, NULL);
+    } else if (jc_init(state, segments[0].data) != JC_RESULT_OK) {
+        return JC_RESULT_ERR_CANT_INIT;
+    }
+
+    state->source_len = segments[0].len;
+    state->segments = segments;
+    state->num_segments = num_segments;
+    return JC_RESULT_OK;
+}
+
+int jc_locate(jc_state const * state, size_t pos, size_t * segment,
+              size_t * offset)
+{
+    size_t index = state->segment_index;
+    size_t base = state->source_base;
+
+    if (state->segments == NULL) {
+        *segment = 0;
+        *offset = pos;
+        return pos < state->source_len;
+    }
+
+    /* Walk from the current segment, as positions are mostly close to it */
+    while (pos < base) {
+        --index;
+        base -= state->segments[index].len;
+    }
+    while (pos - base >= state->segments[index].len) {
+        if (index + 1 == state->num_segments) {
+            return 0;
+        }
+        base += state->segments[index].len;
+        ++index;
+    }
+
+    *segment = index;
+    *offset = pos - base;
+    return 1;
+}
+
+/*
+ * Makes the segment that contains `pos` current in a segmented state.
+ * Returns 0 if the position is past the end of source.
+ */
+int jc_select_segment(jc_state * state, size_t pos)
+{
+    size_t index = 0;
+    size_t offset = 0;
+
+    if (!jc_locate(state, pos, &index, &offset)) {
+        return 0;
+    }
+
+    state->segment_index = index;
+    state->source = state->segments[index].data;
+    state->source_base = pos - offset;
+    state->source_len = state->source_base + state->segments[index].len;
+    return 1;
+}
+
+/*
+ * Makes `pos` accessible through the source of a reader or segmented state.
+ * Returns 0 if it's past the end of source (or of a full window).
+ */
+int jc_load_source(jc_state * state, size_t pos)
+{
+    if (state->refill != NULL) {
+        return jc_refill(state, pos);
+    } else if (state->segments != NULL) {
+        return jc_select_segment(state, pos);
+    }
+
+    return 0;
+}
+
+char jc_char_at(jc_state * state, size_t pos)
+{
+    if ((pos >= state->source_base && pos < state->source_len)
+            || jc_load_source(state, pos)) {
+        return state->source[pos - state->source_base];
+    }
+
+    return JC_CHAR_NULL;
+}
+
+char jc_decode_hex_char(jc_state * state, size_t pos)
+{
+    unsigned int value = 0;
+    size_t i = 0;
+    char c = JC_CHAR_NULL;
+
+    for (i = 0; i < 4; ++i) {
+        c = jc_char_at(state, pos + i);
+        if (c >= '0' && c <= '9') {
+            value = (value << 4) | (c - '0');
+        } else if (c >= 'a' && c <= 'f') {
+            value = (value << 4) | (c - 'a' + 10);
+        } else if (c >= 'A' && c <= 'F') {
+            value = (value << 4) | (c - 'A' + 10);
+        } else {
+            return JC_CHAR_NULL;
+        }
+    }
+
+    return (value < 0x80) ? (char) value : JC_CHAR_NON_ASCII;
+}
+
+/*
+ * Returns the character at `pos` and stores the number of source characters
+ * it occupies into `width`. In escaped (nested) mode escape sequences are
+ * decoded; an invalid or truncated escape sequence reads as the end of source.
+ */
+char jc_decode_char(jc_state * state, size_t pos, size_t * width)
+{
+    char c = jc_char_at(state, pos);
+
+    *width = 1;
+    if (c != JC_CHAR_BACKSLASH || !(state->flags & JC_STATE_FLAG_ESCAPED)) {
+        return c;
+    }
+
+    *width = 2;
+    switch (jc_char_at(state, pos + 1)) {
+    case JC_CHAR_DQUOTE:    return JC_CHAR_DQUOTE;
+    case JC_CHAR_BACKSLASH: return JC_CHAR_BACKSLASH;
+    case JC_CHAR_SLASH:     return JC_CHAR_SLASH;
+    case 'b':               return '\b';
+    case 'f':               return '\f';
+    case 'n':               return '\n';
+    case 'r':               return '\r';
+    case 't':               return '\t';
+    case 'u':
+        *width = 6;
+        return jc_decode_hex_char(state, pos + 2);
+    default:
+        return JC_CHAR_NULL;
+    }
+}
+
+void jc_make_token(jc_state * state, jc_token * token, jc_token_type type,
+                   size_t len)
+{
+    if (token != NULL) {
+        token->type = type;
+        token->start = state->source_pos;
+        token->end = state->source_pos + len;
+    }
+}
+
+void jc_advance_source_pos(jc_state * state, size_t num_of_chars)
+{
+    state->source_pos += num_of_chars;
+}
+
+void jc_expect_next(jc_state * state, size_t expected_token_types)
+{
+    state->expected_token_types = expected_token_types;
+}
+
+int jc_is_expected(jc_state * state, jc_token_type type)
+{
+    if (type == JC_NO_TOKENS_EXPECTED) {
+        return state->expected_token_types == type;
+    } else {
+        return (state->expected_token_types & type) > 0;
+    }
+}
+
+void jc_skip_whitespace(jc_state * state)
+{
+    size_t width = 0;
+    while (isspace(jc_decode_char(state, state->source_pos, &width))) {
+        state->source_pos += width;
+    }
+}
+
+jc_result jc_nest(jc_state * state, jc_nesting_type type)
+{
+    if (state->nesting_level >= JC_MAX_NESTING_LEVEL - 1) {
+        return JC_RESULT_ERR_MAX_NESTING_REACHED;
+    }
+
+    state->nesting_level += 1;
+    state->nesting_stack[state->nesting_level] = type;
+
+    if (state->max_emit_depth != JC_NO_MAX_EMIT_DEPTH
+            && state->nesting_level >= state->max_emit_depth) {
+        state->flags |= JC_STATE_FLAG_SKIP_CONTENTS;
+    }
+    return JC_RESULT_OK;
+}
+
+jc_result jc_unnest(jc_state * state)
+{
+    if (state->nesting_level <= JC_NO_NESTING_LEVEL) {
+        return JC_RESULT_ERR_CORRUPTED_STATE;
+    }
+
+    /* After resynchronization, the parent of the outermost level is unknown */
+    if (state->nesting_level == 0 && state->flags & JC_STATE_FLAG_RESYNCED) {
+        state->nesting_stack[0] = JC_NESTING_TYPE_UNKNOWN;
+        return JC_RESULT_OK;
+    }
+
+    state->nesting_level -= 1;
+    return JC_RESULT_OK;
+}
+
+jc_token_type jc_get_end_token_type_of_current_nesting(jc_state * state)
+{
+    if (JC_NO_NESTING_LEVEL < state->nesting_level
+            && state->nesting_level < JC_MAX_NESTING_LEVEL) {
+        switch (state->nesting_stack[state->nesting_level]) {
+        case JC_NESTING_TYPE_OBJECT:
+            return JC_TOKEN_TYPE_COMMA | JC_TOKEN_TYPE_OBJECT_END;
+        case JC_NESTING_TYPE_ARRAY:
+            return JC_TOKEN_TYPE_COMMA | JC_TOKEN_TYPE_ARRAY_END;
+        default:
+            return JC_TOKEN_TYPE_COMMA | JC_TOKEN_TYPE_OBJECT_END
+                 | JC_TOKEN_TYPE_ARRAY_END;
+        }
+    } else {
+        return JC_NO_TOKENS_EXPECTED;
+    }
+}
+
+jc_token_type jc_get_token_type_after_comma_of_current_nesting(jc_state * state)
+{
+    if (JC_NO_NESTING_LEVEL < state->nesting_level
+            && state->nesting_level < JC_MAX_NESTING_LEVEL) {
+        switch (state->nesting_stack[state->nesting_level]) {
+        case JC_NESTING_TYPE_OBJECT:
+            return JC_TOKEN_TYPE_FIELD_NAME;
+        case JC_NESTING_TYPE_ARRAY:
+            return JC_TOKEN_TYPE_VALUE;
+        default:
+            return JC_TOKEN_TYPE_FIELD_NAME | JC_TOKEN_TYPE_VALUE;
+        }
+    } else {
+        return JC_NO_TOKENS_EXPECTED;
+    }
+}
+
+/*
+ * Moves `pos` from the start of string contents to its closing double quote.
+ * Returns 0 if the source ended before the closing double quote was found.
+ */
+int jc_search_dquote(jc_state * state, size_t * pos)
+{
+    size_t width = 0;
+    size_t escaped_width = 0;
+    char c = jc_decode_char(state, *pos, &width);
+
+    while (c != JC_CHAR_DQUOTE) {
+        if (c == JC_CHAR_NULL) {
+            return 0;
+        } else if (c == JC_CHAR_BACKSLASH) {
+            /* Stop at the backslash if the escaped character is missing */
+            if (jc_decode_char(state, *pos + width, &escaped_width)
+                    == JC_CHAR_NULL) {
+                return 0;
+            }
+            *pos += width;
+            width = escaped_width;
+        }
+
+        *pos += width;
+        c = jc_decode_char(state, *pos, &width);
+    }
+
+    return 1;
+}
+
+/*
+ * Moves source position from the start of object or array contents to its
+ * closing bracket. Brackets inside of strings are ignored, but otherwise the
+ * contents aren't checked.
+ */
+jc_result jc_skip_contents(jc_state * state)
+{
+    size_t depth = 0;
+    size_t width = 0;
+    char c = JC_CHAR_NULL;
+
+    for (;;) {
+        c = jc_decode_char(state, state->source_pos, &width);
+        switch (c) {
+        case JC_CHAR_NULL:
+            return JC_RESULT_ERR_UNEXPECTED_EOF;
+        case JC_CHAR_DQUOTE:
+            state->source_pos += width;
+            if (!jc_search_dquote(state, &state->source_pos)) {
+                return JC_RESULT_ERR_UNEXPECTED_EOF;
+            }
+            jc_decode_char(state, state->source_pos, &width);
+            break;
+        case JC_CHAR_OBJECT_START:
+        case JC_CHAR_ARRAY_START:
+            ++depth;
+            break;
+        case JC_CHAR_OBJECT_END:
+        case JC_CHAR_ARRAY_END:
+            if (depth == 0) {
+                jc_expect_next(state,
+                    jc_get_end_token_type_of_current_nesting(state)
+                    & ~JC_TOKEN_TYPE_COMMA);
+                return JC_RESULT_OK;
+            }
+            --depth;
+            break;
+        default:
+            break;
+        }
+
+        state->source_pos += width;
+    }
+}
+
+/*
+ * Tells whether a string starting at current source position is followed by
+ * a colon, i.e. whether it's a field name.
+ */
+int jc_is_string_followed_by_colon(jc_state * state)
+{
+    size_t width = 0;
+    size_t pos = 0;
+
+    jc_decode_char(state, state->source_pos, &width);
+    pos = state->source_pos + width;
+    if (!jc_search_dquote(state, &pos)) {
+        return 0;
+    }
+
+    do {
+        pos += width;
+    } while (isspace(jc_decode_char(state, pos, &width)));
+    return jc_decode_char(state, pos, &width) == JC_CHAR_COLON;
+}
+
+/*
+ * After resynchronization, decides whether the current nesting level of unknown
+ * type is an object or an array, once the first token after a comma shows it.
+ */
+void jc_resolve_unknown_nesting(jc_state * state, char current_char)
+{
+    if (state->nesting_level == JC_NO_NESTING_LEVEL
+            || state->nesting_stack[state->nesting_level]
+                != JC_NESTING_TYPE_UNKNOWN
+            || !jc_is_expected(state, JC_TOKEN_TYPE_FIELD_NAME)) {
+        return;
+    }
+
+    if (current_char == JC_CHAR_DQUOTE
+            && jc_is_string_followed_by_colon(state)) {
+        state->nesting_stack[state->nesting_level] = JC_NESTING_TYPE_OBJECT;
+        jc_expect_next(state, JC_TOKEN_TYPE_FIELD_NAME);
+    } else {
+        state->nesting_stack[state->nesting_level] = JC_NESTING_TYPE_ARRAY;
+        jc_expect_next(state, JC_TOKEN_TYPE_VALUE);
+    }
+}
+
+/*
+ * Makes a non-final part of a token that doesn't fit into the window of
+ * a reader state, and remembers to continue the token on the next call.
+ */
+jc_result jc_make_part_token(jc_state * state, jc_token * token,
+                             jc_token_type type, size_t len)
+{
+    jc_make_token(state, token, (jc_token_type) (type | JC_TOKEN_FLAG_PART),
+                  len);
+    jc_advance_source_pos(state, len);
+    state->partial_token_type = type;
+    return JC_RESULT_OK;
+}
+
+/*
+ * Makes a token, or the final part of a token if its previous parts were made.
+ */
+void jc_make_last_token(jc_state * state, jc_token * token,
+                        jc_token_type type, size_t len)
+{
+    if (state->partial_token_type != JC_NO_TOKENS_EXPECTED) {
+        type = (jc_token_type) (type | JC_TOKEN_FLAG_PART | JC_TOKEN_FLAG_LAST);
+        state->partial_token_type = JC_NO_TOKENS_EXPECTED;
+    }
+
+    jc_make_token(state, token, type, len);
+}
+
+jc_result jc_parse_string_contents(jc_state * state, jc_token * token,
+                                   jc_token_type token_type)
+{
+    size_t width = 0;
+    size_t end_dquote_pos = state->source_pos;
+
+    if (!jc_search_dquote(state, &end_dquote_pos)) {
+        return (state->flags & JC_STATE_FLAG_WINDOW_FULL)
+            ? jc_make_part_token(state, token, token_type,
+                                 end_dquote_pos - state->source_pos)
+            : JC_RESULT_ERR_UNEXPECTED_EOF;
+    }
+
+    jc_make_last_token(state, token, token_type,
+                       end_dquote_pos - state->source_pos);
+    jc_decode_char(state, end_dquote_pos, &width);
+    state->source_pos = end_dquote_pos + width;
+
+    if (token_type == JC_TOKEN_TYPE_FIELD_NAME) {
+        jc_expect_next(state, JC_TOKEN_TYPE_COLON);
+    } else {
+        jc_expect_next(state,
+            jc_get_end_token_type_of_current_nesting(state));
+    }
+    return JC_RESULT_OK;
+}
+
+jc_result jc_parse_string_or_field_name(jc_state * state, jc_token * token)
+{
+    size_t width = 0;
+    jc_token_type token_type = JC_TOKEN_TYPE_STRING;
+
+    if (jc_is_expected(state, JC_TOKEN_TYPE_FIELD_NAME)) {
+        token_type = JC_TOKEN_TYPE_FIELD_NAME;
+    }
+
+    jc_decode_char(state, state->source_pos, &width);
+    jc_advance_source_pos(state, width);
+    return jc_parse_string_contents(state, token, token_type);
+}
+
+int jc_is_number_char(char c)
+{
+    return c != JC_CHAR_NULL && strchr(JC_VALID_CHARS_IN_NUMBER, c) != NULL;
+}
+
+jc_result jc_parse_number(jc_state * state, jc_token * token)
+{
+    size_t width = 0;
+    size_t token_len = 0;
+    while (jc_is_number_char(
+            jc_decode_char(state, state->source_pos + token_len, &width))) {
+        token_len += width;
+    }
+
+    if (state->flags & JC_STATE_FLAG_WINDOW_FULL) {
+        return jc_make_part_token(state, token, JC_TOKEN_TYPE_NUMBER,
+                                  token_len);
+    }
+
+    jc_make_last_token(state, token, JC_TOKEN_TYPE_NUMBER, token_len);
+    jc_advance_source_pos(state, token_len);
+    jc_expect_next(state, jc_get_end_token_type_of_current_nesting(state));
+    return JC_RESULT_OK;
+}
+
+jc_result jc_parse_literal(jc_state * state, jc_token * token,
+                           jc_token_type token_type, char const * literal)
+{
+    size_t width = 0;
+    size_t token_len = 0;
+    for (; *literal != JC_CHAR_NULL; ++literal) {
+        if (jc_decode_char(state, state->source_pos + token_len, &width)
+                != *literal) {
+            return JC_RESULT_ERR_UNEXPECTED_TOKEN;
+        }
+        token_len += width;
+    }
+
+    jc_make_token(state, token, token_type, token_len);
+    jc_advance_source_pos(state, token_len);
+    jc_expect_next(state, jc_get_end_token_type_of_current_nesting(state));
+    return JC_RESULT_OK;
+}
+
+/*
+ * Tells whether the whole source is in memory and unescaped, so that its
+ * characters may be read directly instead of through `jc_decode_char`.
+ */
+int jc_is_plain_source(jc_state const * state)
+{
+    return state->refill == NULL && state->segments == NULL
+        && !(state->flags & JC_STATE_FLAG_ESCAPED);
+}
+
+char jc_plain_char_at(jc_state const * state, size_t pos)
+{
+    return (pos < state->source_len) ? state->source[pos] : JC_CHAR_NULL;
+}
+
+/*
+ * Parses a string or field name of a plain source of trusted input.
+ */
+jc_result jc_parse_plain_string(jc_state * state, jc_token * token)
+{
+    char const * source = state->source;
+    size_t len = state->source_len;
+    size_t pos = state->source_pos + 1;
+    jc_token_type token_type = jc_is_expected(state, JC_TOKEN_TYPE_FIELD_NAME)
+                             ? JC_TOKEN_TYPE_FIELD_NAME
+                             : JC_TOKEN_TYPE_STRING;
+
+    while (pos < len && source[pos] != JC_CHAR_DQUOTE) {
+        if (source[pos] == JC_CHAR_NULL) {
+            return JC_RESULT_ERR_UNEXPECTED_EOF;
+        } else if (source[pos] == JC_CHAR_BACKSLASH) {
+            if (jc_plain_char_at(state, pos + 1) == JC_CHAR_NULL) {
+                return JC_RESULT_ERR_UNEXPECTED_EOF;
+            }
+            ++pos;
+        }
+        ++pos;
+    }
+
+    if (pos >= len) {
+        return JC_RESULT_ERR_UNEXPECTED_EOF;
+    }
+
+    ++state->source_pos;
+    jc_make_token(state, token, token_type, pos - state->source_pos);
+    state->source_pos = pos + 1;
+    jc_expect_next(state, token_type == JC_TOKEN_TYPE_FIELD_NAME
+                          ? JC_TOKEN_TYPE_COLON
+                          : jc_get_end_token_type_of_current_nesting(state));
+    return JC_RESULT_OK;
+}
+
+/*
+ * Parses a number of a plain source of trusted input.
+ */
+jc_result jc_parse_plain_number(jc_state * state, jc_token * token)
+{
+    size_t pos = state->source_pos;
+
+    while (jc_is_number_char(jc_plain_char_at(state, pos))) {
+        ++pos;
+    }
+
+    jc_make_token(state, token, JC_TOKEN_TYPE_NUMBER, pos - state->source_pos);
+    state->source_pos = pos;
+    jc_expect_next(state, jc_get_end_token_type_of_current_nesting(state));
+    return JC_RESULT_OK;
+}
+
+/*
+ * Scans the next token of trusted input, dispatching on its first character.
+ * Expected token types are only maintained as far as needed to tell field
+ * names from strings. Whitespace, strings and numbers of plain sources are
+ * scanned by direct reads.
+ */
+jc_result jc_scan_trusted_token(jc_state * state, jc_token * token)
+{
+    char current_char = '\0';
+    size_t width = 1;
+    int plain = jc_is_plain_source(state);
+
+    if (plain) {
+        while (isspace((unsigned char) jc_plain_char_at(state,
+                                                        state->source_pos))) {
+            ++state->source_pos;
+        }
+        current_char = jc_plain_char_at(state, state->source_pos);
+    } else {
+        jc_skip_whitespace(state);
+        current_char = jc_decode_char(state, state->source_pos, &width);
+    }
+    jc_resolve_unknown_nesting(state, current_char);
+
+    switch (current_char) {
+    case JC_CHAR_NULL:
+        return (state->nesting_level == JC_NO_NESTING_LEVEL
+                || state->flags & JC_STATE_FLAG_RESYNCED)
+            ? JC_RESULT_EOF
+            : JC_RESULT_ERR_UNEXPECTED_EOF;
+    case JC_CHAR_OBJECT_START:
+        jc_make_token(state, token, JC_TOKEN_TYPE_OBJECT_START, width);
+        jc_advance_source_pos(state, width);
+        jc_expect_next(state, JC_TOKEN_TYPE_FIELD_NAME);
+        return jc_nest(state, JC_NESTING_TYPE_OBJECT);
+    case JC_CHAR_ARRAY_START:
+        jc_make_token(state, token, JC_TOKEN_TYPE_ARRAY_START, width);
+        jc_advance_source_pos(state, width);
+        jc_expect_next(state, JC_TOKEN_TYPE_VALUE);
+        return jc_nest(state, JC_NESTING_TYPE_ARRAY);
+    case JC_CHAR_OBJECT_END:
+    case JC_CHAR_ARRAY_END:
+        jc_make_token(state, token, current_char == JC_CHAR_OBJECT_END
+                                    ? JC_TOKEN_TYPE_OBJECT_END
+                                    : JC_TOKEN_TYPE_ARRAY_END, width);
+        jc_advance_source_pos(state, width);
+        return (jc_unnest(state) == JC_RESULT_OK)
+            ? JC_RESULT_OK
+            : JC_RESULT_ERR_CORRUPTED_STATE;
+    case JC_CHAR_COLON:
+        jc_make_token(state, token, JC_TOKEN_TYPE_COLON, width);
+        jc_advance_source_pos(state, width);
+        jc_expect_next(state, JC_TOKEN_TYPE_VALUE);
+        return JC_RESULT_OK;
+    case JC_CHAR_COMMA:
+        jc_make_token(state, token, JC_TOKEN_TYPE_COMMA, width);
+        jc_advance_source_pos(state, width);
+        jc_expect_next(state,
+            jc_get_token_type_after_comma_of_current_nesting(state));
+        return JC_RESULT_OK;
+    case JC_CHAR_DQUOTE:
+        return plain
+            ? jc_parse_plain_string(state, token)
+            : jc_parse_string_or_field_name(state, token);
+    case 't':
+        return jc_parse_literal(state, token, JC_TOKEN_TYPE_TRUE, JC_LIT_TRUE);
+    case 'f':
+        return jc_parse_literal(state, token, JC_TOKEN_TYPE_FALSE,
+                                JC_LIT_FALSE);
+    case 'n':
+        return jc_parse_literal(state, token, JC_TOKEN_TYPE_NULL, JC_LIT_NULL);
+    default:
+        if (!jc_is_number_char(current_char)) {
+            return JC_RESULT_ERR_UNEXPECTED_TOKEN;
+        }
+        return plain
+            ? jc_parse_plain_number(state, token)
+            : jc_parse_number(state, token);
+    }
+}
+
+jc_result jc_scan_token(jc_state * state, jc_token * token)
+{
+    char current_char = '\0';
+    size_t width = 0;
+    jc_result result = JC_RESULT_OK;
+
+    state->flags &= ~JC_STATE_FLAG_WINDOW_FULL;
+
+    /* Continue a token that didn't fit into the window */
+
+    if (state->partial_token_type == JC_TOKEN_TYPE_NUMBER) {
+        return jc_parse_number(state, token);
+    } else if (state->partial_token_type != JC_NO_TOKENS_EXPECTED) {
+        return jc_parse_string_contents(state, token,
+                                        state->partial_token_type);
+    }
+
+    if (state->flags & JC_STATE_FLAG_SKIP_CONTENTS) {
+        state->flags &= ~JC_STATE_FLAG_SKIP_CONTENTS;
+        result = jc_skip_contents(state);
+        if (result != JC_RESULT_OK) {
+            return result;
+        }
+    }
+
+    if (state->flags & JC_STATE_FLAG_TRUSTED) {
+        return jc_scan_trusted_token(state, token);
+    }
+
+    jc_skip_whitespace(state);
+    current_char = jc_decode_char(state, state->source_pos, &width);
+
+    /* Check for EOF */
+
+    if (jc_is_expected(state, JC_NO_TOKENS_EXPECTED)) {
+        return (current_char == JC_CHAR_NULL)
+            ? JC_RESULT_EOF
+            : JC_RESULT_ERR_GARBAGE;
+    } else if (current_char == JC_CHAR_NULL) {
+        return (state->flags & JC_STATE_FLAG_RESYNCED)
+            ? JC_RESULT_EOF
+            : JC_RESULT_ERR_UNEXPECTED_EOF;
+    }
+
+    jc_resolve_unknown_nesting(state, current_char);
+
+    /* Parse object start */
+
+    if (jc_is_expected(state, JC_TOKEN_TYPE_OBJECT_START)
+            && current_char == JC_CHAR_OBJECT_START) {
+        jc_make_token(state, token, JC_TOKEN_TYPE_OBJECT_START, width);
+        jc_advance_source_pos(state, width);
+        jc_expect_next(state,
+            JC_TOKEN_TYPE_FIELD_NAME | JC_TOKEN_TYPE_OBJECT_END);
+        return jc_nest(state, JC_NESTING_TYPE_OBJECT);
+    }
+
+    /* Parse array start */
+
+    if (jc_is_expected(state, JC_TOKEN_TYPE_ARRAY_START)
+            && current_char == JC_CHAR_ARRAY_START) {
+        jc_make_token(state, token, JC_TOKEN_TYPE_ARRAY_START, width);
+        jc_advance_source_pos(state, width);
+        jc_expect_next(state, JC_TOKEN_TYPE_VALUE | JC_TOKEN_TYPE_ARRAY_END);
+        return jc_nest(state, JC_NESTING_TYPE_ARRAY);
+    }
+
+    /* Parse object end */
+
+    if (jc_is_expected(state, JC_TOKEN_TYPE_OBJECT_END)
+            && current_char == JC_CHAR_OBJECT_END) {
+        jc_make_token(state, token, JC_TOKEN_TYPE_OBJECT_END, width);
+        jc_advance_source_pos(state, width);
+
+        if (jc_unnest(state) != JC_RESULT_OK) {
+            return JC_RESULT_ERR_CORRUPTED_STATE;
+        }
+
+        jc_expect_next(state, jc_get_end_token_type_of_current_nesting(state));
+        return JC_RESULT_OK;
+    }
+
+    /* Parse array end */
+
+    if (jc_is_expected(state, JC_TOKEN_TYPE_ARRAY_END)
+            && current_char == JC_CHAR_ARRAY_END) {
+        jc_make_token(state, token, JC_TOKEN_TYPE_ARRAY_END, width);
+        jc_advance_source_pos(state, width);
+
+        if (jc_unnest(state) != JC_RESULT_OK) {
+            return JC_RESULT_ERR_CORRUPTED_STATE;
+        }
+
+        jc_expect_next(state, jc_get_end_token_type_of_current_nesting(state));
+        return JC_RESULT_OK;
+    }
+
+    /* Parse colon */
+
+    if (jc_is_expected(state, JC_TOKEN_TYPE_COLON)
+            && current_char == JC_CHAR_COLON) {
+        jc_make_token(state, token, JC_TOKEN_TYPE_COLON, width);
+        jc_advance_source_pos(state, width);
+        jc_expect_next(state, JC_TOKEN_TYPE_VALUE);
+        return JC_RESULT_OK;
+    }
+
+    /* Parse comma */
+
+    if (jc_is_expected(state, JC_TOKEN_TYPE_COMMA)
+            && current_char == JC_CHAR_COMMA) {
+        jc_make_token(state, token, JC_TOKEN_TYPE_COMMA, width);
+        jc_advance_source_pos(state, width);
+        jc_expect_next(state,
+            jc_get_token_type_after_comma_of_current_nesting(state));
+        return JC_RESULT_OK;
+    }
+
+    /* Parse field name or string */
+
+    if (jc_is_expected(state, JC_TOKEN_TYPE_FIELD_NAME | JC_TOKEN_TYPE_STRING)
+            && current_char == JC_CHAR_DQUOTE) {
+        return jc_parse_string_or_field_name(state, token);
+    }
+
+    /* Parse number */
+
+    if (jc_is_expected(state, JC_TOKEN_TYPE_NUMBER)
+            && jc_is_number_char(current_char)) {
+        return jc_parse_number(state, token);
+    }
+
+    /* Parse literals */
+
+    if (jc_is_expected(state, JC_TOKEN_TYPE_TRUE)
+            && strchr(JC_LIT_TRUE, current_char) != NULL) {
+        return jc_parse_literal(state, token, JC_TOKEN_TYPE_TRUE, JC_LIT_TRUE);
+    }
+
+    if (jc_is_expected(state, JC_TOKEN_TYPE_FALSE)
+            && strchr(JC_LIT_FALSE, current_char) != NULL) {
+        return jc_parse_literal(state, token, JC_TOKEN_TYPE_FALSE, JC_LIT_FALSE);
+    }
+
+    if (jc_is_expected(state, JC_TOKEN_TYPE_NULL)
+            && strchr(JC_LIT_NULL, current_char) != NULL) {
+        return jc_parse_literal(state, token, JC_TOKEN_TYPE_NULL, JC_LIT_NULL);
+    }
+
+    return JC_RESULT_ERR_UNEXPECTED_TOKEN;
+}
+
+unsigned long jc_hash(unsigned long hash, char const * data, size_t len)
+{
+    size_t i = 0;
+    for (i = 0; i < len; ++i) {
+        hash = ((hash ^ (unsigned char) data[i]) * JC_HASH_PRIME) & JC_HASH_MASK;
+    }
+    return hash;
+}
+
+/*
+ * Stores decimal digits of an index into `digits` in reverse order, and
+ * returns their number.
+ */
+size_t jc_format_index(size_t index, char * digits)
+{
+    size_t num_digits = 0;
+
+    do {
+        digits[num_digits++] = (char) ('0' + index % 10);
+        index /= 10;
+    } while (index > 0);
+
+    return num_digits;
+}
+
+#ifdef JC_PATH_TRACKING
+
+unsigned long jc_path_hash_at(jc_state const * state, int depth)
+{
+    return (depth > 0) ? state->path_levels[depth - 1].hash : JC_HASH_INIT;
+}
+
+void jc_path_set_index(jc_state * state, int level, size_t index)
+{
+    char digits[sizeof(size_t) * 3];
+    size_t num_digits = jc_format_index(index, digits);
+    unsigned long hash = jc_hash(jc_path_hash_at(state, level), "", 1);
+
+    while (num_digits > 0) {
+        hash = jc_hash(hash, &digits[--num_digits], 1);
+    }
+
+    state->path_levels[level].index = index;
+    state->path_levels[level].hash = hash;
+}
+
+void jc_path_set_key(jc_state * state, int level, jc_token const * token)
+{
+    jc_path_level * path_level = &state->path_levels[level];
+    size_t pos = 0;
+    char c = JC_CHAR_NULL;
+
+    /* A part of a field name that continues the previous one continues its
+     * hash, too */
+    if (!(token->type & JC_TOKEN_FLAG_PART)
+            || path_level->key_end != token->start) {
+        path_level->key_start = token->start;
+        path_level->hash = jc_hash(jc_path_hash_at(state, level), "", 1);
+    }
+
+    if (state->segments == NULL) {
+        path_level->hash = jc_hash(path_level->hash,
+                                   jc_token_data(state, token),
+                                   token->end - token->start);
+    } else {
+        for (pos = token->start; pos < token->end; ++pos) {
+            c = jc_char_at(state, pos);
+            path_level->hash = jc_hash(path_level->hash, &c, 1);
+        }
+    }
+    path_level->key_end = token->end;
+}
+
+/*
+ * Updates the path after a token was scanned
+ */
+void jc_track_path(jc_state * state, jc_token const * token)
+{
+    int level = state->nesting_level;
+
+    if (level == JC_NO_NESTING_LEVEL) {
+        state->path_depth = 0;
+        return;
+    }
+
+    switch (token->type & ~(JC_TOKEN_FLAG_PART | JC_TOKEN_FLAG_LAST)) {
+    case JC_TOKEN_TYPE_ARRAY_START:
+        jc_path_set_index(state, level, 0);
+        state->path_depth = level;
+        return;
+    case JC_TOKEN_TYPE_OBJECT_START:
+        state->path_depth = level;
+        return;
+    case JC_TOKEN_TYPE_COMMA:
+        if (state->nesting_stack[level] == JC_NESTING_TYPE_ARRAY) {
+            jc_path_set_index(state, level,
+                              state->path_levels[level].index + 1);
+        }
+        state->path_depth = level;
+        return;
+    case JC_TOKEN_TYPE_FIELD_NAME:
+        jc_path_set_key(state, level, token);
+        break;
+    default:
+        break;
+    }
+
+    state->path_depth = level + 1;
+}
+
+unsigned long jc_path_hash(jc_state const * state)
+{
+    return jc_path_hash_at(state, state->path_depth);
+}
+
+int jc_append_char(char * buffer, size_t size, size_t * len, char c)
+{
+    if (*len + 1 >= size) {
+        return 0;
+    }
+
+    buffer[(*len)++] = c;
+    return 1;
+}
+
+jc_result jc_current_path(jc_state * state, char * buffer, size_t size)
+{
+    char digits[sizeof(size_t) * 3];
+    size_t num_digits = 0;
+    size_t len = 0;
+    size_t pos = 0;
+    int level = 0;
+    int fits = 1;
+    char c = JC_CHAR_NULL;
+
+    if (state->refill != NULL) {
+        return JC_RESULT_ERR_CANT_INIT;
+    } else if (size == 0) {
+        return JC_RESULT_ERR_BUFFER_FULL;
+    }
+
+    for (level = 0; level < state->path_depth && fits; ++level) {
+        fits = jc_append_char(buffer, size, &len, JC_CHAR_SLASH);
+        if (state->nesting_stack[level] == JC_NESTING_TYPE_ARRAY) {
+            num_digits = jc_format_index(state->path_levels[level].index,
+                                         digits);
+            while (num_digits > 0 && fits) {
+                fits = jc_append_char(buffer, size, &len,
+                                      digits[--num_digits]);
+            }
+            continue;
+        }
+
+        for (pos = state->path_levels[level].key_start;
+                pos < state->path_levels[level].key_end && fits; ++pos) {
+            c = jc_char_at(state, pos);
+            if (c == '~' || c == JC_CHAR_SLASH) {
+                fits = jc_append_char(buffer, size, &len, '~')
+                    && jc_append_char(buffer, size, &len,
+                                      (char) (c == '~' ? '0' : '1'));
+            } else {
+                fits = jc_append_char(buffer, size, &len, c);
+            }
+        }
+    }
+
+    buffer[len] = JC_CHAR_NULL;
+    return fits ? JC_RESULT_OK : JC_RESULT_ERR_BUFFER_FULL;
+}
+
+unsigned long jc_pointer_hash(char const * pointer)
+{
+    unsigned long hash = JC_HASH_INIT;
+    char c = JC_CHAR_NULL;
+
+    for (; *pointer != JC_CHAR_NULL; ++pointer) {
+        c = *pointer;
+        if (c == JC_CHAR_SLASH) {
+            c = JC_CHAR_NULL;
+        } else if (c == '~' && (pointer[1] == '0' || pointer[1] == '1')) {
+            c = (*++pointer == '0') ? '~' : JC_CHAR_SLASH;
+        }
+        hash = jc_hash(hash, &c, 1);
+    }
+
+    return hash;
+}
+
+int jc_pointer_depth(char const * pointer)
+{
+    int depth = 0;
+
+    for (; *pointer != JC_CHAR_NULL; ++pointer) {
+        depth += (*pointer == JC_CHAR_SLASH);
+    }
+
+    return depth;
+}
+
+jc_result jc_find_path_value(jc_state * state, unsigned long path_hash,
+                             jc_token * value)
+{
+    jc_result result = JC_RESULT_OK;
+
+    while ((result = jc_next_token(state, value)) == JC_RESULT_OK) {
+        if ((value->type & JC_TOKEN_TYPE_SCALAR) != 0
+                && jc_path_hash(state) == path_hash) {
+            return JC_RESULT_OK;
+        }
+    }
+
+    return result;
+}
+
+#endif
+
+/*
+ * Scans the next token and keeps the path of the state up to date
+ */
+jc_result jc_fetch_token(jc_state * state, jc_token * token)
+{
+#ifdef JC_PATH_TRACKING
+    jc_token scanned;
+    jc_token * target = (token != NULL) ? token : &scanned;
+    jc_result result = jc_scan_token(state, target);
+
+    if (result == JC_RESULT_OK) {
+        jc_track_path(state, target);
+    }
+    return result;
+#else
+    return jc_scan_token(state, token);
+#endif
+}
+
+jc_result jc_next_token(jc_state * state, jc_token * token)
+{
+    if (state == NULL) {
+        return JC_RESULT_ERR_CORRUPTED_STATE;
+    }
+
+    if (state->flags & JC_STATE_FLAG_LOOKAHEAD) {
+        state->flags &= ~JC_STATE_FLAG_LOOKAHEAD;
+        if (token != NULL) {
+            *token = state->lookahead_token;
+        }
+        return state->lookahead_result;
+    }
+
+    return jc_fetch_token(state, token);
+}
+
+jc_result jc_peek_token(jc_state * state, jc_token * token)
+{
+    if (state == NULL) {
+        return JC_RESULT_ERR_CORRUPTED_STATE;
+    }
+
+    if (!(state->flags & JC_STATE_FLAG_LOOKAHEAD)) {
+        state->lookahead_result = jc_fetch_token(state,
+                                                 &state->lookahead_token);
+        state->flags |= JC_STATE_FLAG_LOOKAHEAD;
+    }
+
+    if (token != NULL) {
+        *token = state->lookahead_token;
+    }
+    return state->lookahead_result;
+}
+
+char const * jc_token_data(jc_state const * state, jc_token const * token)
+{
+    size_t index = 0;
+    size_t offset = 0;
+
+    if (state->segments != NULL
+            && jc_locate(state, token->start, &index, &offset)) {
+        return state->segments[index].data + offset;
+    }
+
+    return state->source + (token->start - state->source_base);
+}
+
+size_t jc_token_parts(jc_state const * state, jc_token const * token,
+                      jc_segment * parts, size_t max_parts)
+{
+    size_t pos = token->start;
+    size_t index = 0;
+    size_t offset = 0;
+    size_t len = 0;
+    size_t num_parts = 0;
+
+    if (token->start >= token->end || max_parts == 0) {
+        return 0;
+    } else if (state->segments == NULL) {
+        parts[0].data = jc_token_data(state, token);
+        parts[0].len = token->end - token->start;
+        return 1;
+    } else if (!jc_locate(state, pos, &index, &offset)) {
+        return 0;
+    }
+
+    for (; pos < token->end && num_parts < max_parts; ++index, offset = 0) {
+        len = state->segments[index].len - offset;
+        len = (len > token->end - pos) ? token->end - pos : len;
+        if (len > 0) {
+            parts[num_parts].data = state->segments[index].data + offset;
+            parts[num_parts].len = len;
+            ++num_parts;
+            pos += len;
+        }
+    }
+
+    return num_parts;
+}
+
+jc_result jc_decode_integer(char const * data, size_t len, long * value)
+{
+    int negative = (len > 0 && data[0] == '-');
+    unsigned long limit = negative ? (unsigned long) LONG_MAX + 1 : LONG_MAX;
+    unsigned long magnitude = 0;
+    unsigned long digit = 0;
+    size_t pos = negative ? 1 : 0;
+
+    if (pos == len) {
+        return JC_RESULT_ERR_UNEXPECTED_TOKEN;
+    }
+
+    for (; pos < len; ++pos) {
+        if (data[pos] < '0' || data[pos] > '9') {
+            return JC_RESULT_ERR_UNEXPECTED_TOKEN;
+        }
+
+        digit = data[pos] - '0';
+        if (magnitude > (limit - digit) / 10) {
+            return JC_RESULT_ERR_UNEXPECTED_TOKEN;
+        }
+        magnitude = magnitude * 10 + digit;
+    }
+
+    if (!negative || magnitude == 0) {
+        *value = (long) magnitude;
+    } else {
+        *value = -(long) (magnitude - 1) - 1;
+    }
+    return JC_RESULT_OK;
+}
+
+/*
+ * Parses the four hex digits of a unicode escape, returns 0 if any isn't one
+ */
+int jc_parse_hex(char const * data, unsigned long * value)
+{
+    size_t i = 0;
+    char c = JC_CHAR_NULL;
+
+    *value = 0;
+    for (i = 0; i < 4; ++i) {
+        c = data[i];
+        if (c >= '0' && c <= '9') {
+            *value = (*value << 4) | (c - '0');
+        } else if (c >= 'a' && c <= 'f') {
+            *value = (*value << 4) | (c - 'a' + 10);
+        } else if (c >= 'A' && c <= 'F') {
+            *value = (*value << 4) | (c - 'A' + 10);
+        } else {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+/*
+ * Decodes the escape sequence at `pos` into a code point and moves `pos` past
+ * it, returns 0 if it's invalid
+ */
+int jc_decode_escape(char const * data, size_t len, size_t * pos,
+                     unsigned long * code)
+{
+    unsigned long low = 0;
+
+    if (*pos + 1 >= len) {
+        return 0;
+    }
+
+    *pos += 2;
+    switch (data[*pos - 1]) {
+    case JC_CHAR_DQUOTE:    *code = JC_CHAR_DQUOTE;    return 1;
+    case JC_CHAR_BACKSLASH: *code = JC_CHAR_BACKSLASH; return 1;
+    case JC_CHAR_SLASH:     *code = JC_CHAR_SLASH;     return 1;
+    case 'b':               *code = '\b';              return 1;
+    case 'f':               *code = '\f';              return 1;
+    case 'n':               *code = '\n';              return 1;
+    case 'r':               *code = '\r';              return 1;
+    case 't':               *code = '\t';              return 1;
+    case 'u':
+        break;
+    default:
+        return 0;
+    }
+
+    if (*pos + 4 > len || !jc_parse_hex(data + *pos, code)) {
+        return 0;
+    }
+    *pos += 4;
+
+    if (*code >= 0xDC00 && *code <= 0xDFFF) {
+        return 0;
+    } else if (*code < 0xD800 || *code > 0xDBFF) {
+        return 1;
+    }
+
+    if (*pos + 6 > len || data[*pos] != JC_CHAR_BACKSLASH
+            || data[*pos + 1] != 'u' || !jc_parse_hex(data + *pos + 2, &low)
+            || low < 0xDC00 || low > 0xDFFF) {
+        return 0;
+    }
+    *pos += 6;
+    *code = 0x10000 + ((*code - 0xD800) << 10) + (low - 0xDC00);
+    return 1;
+}
+
+/*
+ * Stores the UTF-8 encoding of a code point into `bytes`, returns its length
+ */
+size_t jc_encode_utf8(unsigned long code, char * bytes)
+{
+    if (code < 0x80) {
+        bytes[0] = (char) code;
+        return 1;
+    } else if (code < 0x800) {
+        bytes[0] = (char) (0xC0 | (code >> 6));
+        bytes[1] = (char) (0x80 | (code & 0x3F));
+        return 2;
+    } else if (code < 0x10000) {
+        bytes[0] = (char) (0xE0 | (code >> 12));
+        bytes[1] = (char) (0x80 | ((code >> 6) & 0x3F));
+        bytes[2] = (char) (0x80 | (code & 0x3F));
+        return 3;
+    }
+
+    bytes[0] = (char) (0xF0 | (code >> 18));
+    bytes[1] = (char) (0x80 | ((code >> 12) & 0x3F));
+    bytes[2] = (char) (0x80 | ((code >> 6) & 0x3F));
+    bytes[3] = (char) (0x80 | (code & 0x3F));
+    return 4;
+}
+
+jc_result jc_decode_string(char const * data, size_t len, char * buffer,
+                           size_t size, size_t * decoded_len)
+{
+    char bytes[4];
+    size_t num_bytes = 0;
+    unsigned long code = 0;
+    size_t pos = 0;
+
+    *decoded_len = 0;
+    if (size == 0) {
+        return JC_RESULT_ERR_BUFFER_FULL;
+    }
+
+    while (pos < len) {
+        if (data[pos] != JC_CHAR_BACKSLASH) {
+            bytes[0] = data[pos++];
+            num_bytes = 1;
+        } else if (jc_decode_escape(data, len, &pos, &code)) {
+            num_bytes = jc_encode_utf8(code, bytes);
+        } else {
+            buffer[*decoded_len] = JC_CHAR_NULL;
+            return JC_RESULT_ERR_UNEXPECTED_TOKEN;
+        }
+
+        if (*decoded_len + num_bytes >= size) {
+            buffer[*decoded_len] = JC_CHAR_NULL;
+            return JC_RESULT_ERR_BUFFER_FULL;
+        }
+        memcpy(buffer + *decoded_len, bytes, num_bytes);
+        *decoded_len += num_bytes;
+    }
+
+    buffer[*decoded_len] = JC_CHAR_NULL;
+    return JC_RESULT_OK;
+}
+
+jc_result jc_count_elements(jc_state * state, size_t * count)
+{
+    size_t pos = 0;
+    size_t width = 0;
+    size_t depth = 0;
+    size_t num_commas = 0;
+    int has_contents = 0;
+
+    if (state == NULL || state->nesting_level == JC_NO_NESTING_LEVEL
+            || state->flags & JC_STATE_FLAG_LOOKAHEAD
+            || state->partial_token_type != JC_NO_TOKENS_EXPECTED) {
+        return JC_RESULT_ERR_UNEXPECTED_TOKEN;
+    }
+
+    for (pos = state->source_pos; ; pos += width) {
+        switch (jc_decode_char(state, pos, &width)) {
+        case JC_CHAR_NULL:
+            return JC_RESULT_ERR_UNEXPECTED_EOF;
+        case JC_CHAR_DQUOTE:
+            pos += width;
+            if (!jc_search_dquote(state, &pos)) {
+                return JC_RESULT_ERR_UNEXPECTED_EOF;
+            }
+            jc_decode_char(state, pos, &width);
+            has_contents = 1;
+            continue;
+        case JC_CHAR_OBJECT_START:
+        case JC_CHAR_ARRAY_START:
+            ++depth;
+            has_contents = 1;
+            continue;
+        case JC_CHAR_OBJECT_END:
+        case JC_CHAR_ARRAY_END:
+            if (depth > 0) {
+                --depth;
+                continue;
+            }
+            break;
+        case JC_CHAR_COMMA:
+            num_commas += (depth == 0);
+            continue;
+        case ' ':
+        case '\t':
+        case '\n':
+        case '\r':
+            continue;
+        default:
+            has_contents = 1;
+            continue;
+        }
+        break;
+    }
+
+    /* A new element is pending unless we're in the middle of one */
+    *count = num_commas;
+    if (has_contents && jc_is_expected(state,
+            jc_get_token_type_after_comma_of_current_nesting(state))) {
+        ++(*count);
+    }
+    return JC_RESULT_OK;
+}
+
+jc_result jc_skip_container(jc_state * state)
+{
+    if (state == NULL || state->nesting_level == JC_NO_NESTING_LEVEL
+            || state->flags & JC_STATE_FLAG_LOOKAHEAD
+            || state->partial_token_type != JC_NO_TOKENS_EXPECTED) {
+        return JC_RESULT_ERR_UNEXPECTED_TOKEN;
+    }
+
+    state->flags |= JC_STATE_FLAG_SKIP_CONTENTS;
+    return JC_RESULT_OK;
+}
+
+/*
+ * Appends characters to a flattened path and keeps it null-terminated.
+ * Returns 0 if they don't fit.
+ */
+int jc_flatten_append(char * path, size_t size, size_t * len,
+                      char const * data, size_t data_len)
+{
+    if (*len + data_len >= size) {
+        return 0;
+    }
+
+    memcpy(path + *len, data, data_len);
+    *len += data_len;
+    path[*len] = JC_CHAR_NULL;
+    return 1;
+}
+
+int jc_flatten_append_index(char * path, size_t size, size_t * len,
+                            size_t index)
+{
+    char digits[sizeof(size_t) * 3];
+    char text[sizeof(size_t) * 3 + 2];
+    size_t num_digits = jc_format_index(index, digits);
+    size_t text_len = 0;
+
+    text[text_len++] = JC_CHAR_ARRAY_START;
+    while (num_digits > 0) {
+        text[text_len++] = digits[--num_digits];
+    }
+    text[text_len++] = JC_CHAR_ARRAY_END;
+
+    return jc_flatten_append(path, size, len, text, text_len);
+}
+
+int jc_flatten_append_key(jc_state * state, char * path, size_t size,
+                          size_t * len, jc_token const * token)
+{
+    size_t pos = 0;
+    char c = JC_CHAR_NULL;
+
+    if (state->segments == NULL) {
+        return jc_flatten_append(path, size, len, jc_token_data(state, token),
+                                 token->end - token->start);
+    }
+
+    for (pos = token->start; pos < token->end; ++pos) {
+        c = jc_char_at(state, pos);
+        if (!jc_flatten_append(path, size, len, &c, 1)) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+jc_result jc_flatten(jc_state * state, char * path, size_t size,
+                     jc_flatten_fn callback, void * ctx)
+{
+    size_t bases[JC_MAX_NESTING_LEVEL];
+    size_t indices[JC_MAX_NESTING_LEVEL];
+    int in_array[JC_MAX_NESTING_LEVEL];
+    int depth = 0;
+    size_t len = 0;
+    jc_token token;
+    jc_result result;
+
+    if (state == NULL || path == NULL || callback == NULL
+            || state->refill != NULL) {
+        return JC_RESULT_ERR_CANT_INIT;
+    } else if (size == 0) {
+        return JC_RESULT_ERR_BUFFER_FULL;
+    }
+
+    path[0] = JC_CHAR_NULL;
+    for (;;) {
+        result = jc_next_token(state, &token);
+        if (result != JC_RESULT_OK) {
+            return result;
+        }
+
+        switch (token.type) {
+        case JC_TOKEN_TYPE_OBJECT_START:
+        case JC_TOKEN_TYPE_ARRAY_START:
+            if (depth == JC_MAX_NESTING_LEVEL) {
+                return JC_RESULT_ERR_MAX_NESTING_REACHED;
+            }
+            bases[depth] = len;
+            indices[depth] = 0;
+            in_array[depth] = (token.type == JC_TOKEN_TYPE_ARRAY_START);
+            if (in_array[depth++]
+                    && !jc_flatten_append_index(path, size, &len, 0)) {
+                return JC_RESULT_ERR_BUFFER_FULL;
+            }
+            continue;
+        case JC_TOKEN_TYPE_OBJECT_END:
+        case JC_TOKEN_TYPE_ARRAY_END:
+            if (depth == 0) {
+                return JC_RESULT_ERR_UNEXPECTED_TOKEN;
+            }
+            len = bases[--depth];
+            path[len] = JC_CHAR_NULL;
+            break;
+        case JC_TOKEN_TYPE_FIELD_NAME:
+            if (depth == 0) {
+                return JC_RESULT_ERR_UNEXPECTED_TOKEN;
+            }
+            len = bases[depth - 1];
+            if ((len > 0 && !jc_flatten_append(path, size, &len, ".", 1))
+                    || !jc_flatten_append_key(state, path, size, &len,
+                                              &token)) {
+                return JC_RESULT_ERR_BUFFER_FULL;
+            }
+            continue;
+        case JC_TOKEN_TYPE_COMMA:
+            if (depth == 0) {
+                return JC_RESULT_ERR_UNEXPECTED_TOKEN;
+            }
+            len = bases[depth - 1];
+            if (in_array[depth - 1] && !jc_flatten_append_index(path, size,
+                    &len, ++indices[depth - 1])) {
+                return JC_RESULT_ERR_BUFFER_FULL;
+            }
+            continue;
+        case JC_TOKEN_TYPE_COLON:
+            continue;
+        default:
+            if (!callback(ctx, path, len, &token)) {
+                return JC_RESULT_OK;
+            }
+            break;
+        }
+
+        if (depth == 0) {
+            return JC_RESULT_OK;
+        }
+    }
+}
+
+/*
+ * Returns the type of the first token of a value starting with given character,
+ * or JC_NO_TOKENS_EXPECTED if no value can start with it.
+ */
+jc_token_type jc_get_value_type(char c)
+{
+    switch (c) {
+    case JC_CHAR_OBJECT_START:  return JC_TOKEN_TYPE_OBJECT_START;
+    case JC_CHAR_ARRAY_START:   return JC_TOKEN_TYPE_ARRAY_START;
+    case JC_CHAR_DQUOTE:        return JC_TOKEN_TYPE_STRING;
+    case 't':                   return JC_TOKEN_TYPE_TRUE;
+    case 'f':                   return JC_TOKEN_TYPE_FALSE;
+    case 'n':                   return JC_TOKEN_TYPE_NULL;
+    default:
+        return jc_is_number_char(c)
+            ? JC_TOKEN_TYPE_NUMBER
+            : (jc_token_type) JC_NO_TOKENS_EXPECTED;
+    }
+}
+
+/*
+ * Tells whether a double quote at `pos` is escaped, i.e. it's preceded by an
+ * odd number of backslashes.
+ */
+int jc_is_escaped_backwards(char const * source, size_t pos)
+{
+    size_t num_backslashes = 0;
+    while (pos > num_backslashes
+            && source[pos - num_backslashes - 1] == JC_CHAR_BACKSLASH) {
+        ++num_backslashes;
+    }
+    return num_backslashes % 2;
+}
+
+/*
+ * Moves `pos` backwards from the end of an array element to the comma or
+ * bracket preceding the element. Returns 0 if the start of the source was
+ * reached first, and -1 on unbalanced brackets.
+ */
+int jc_search_element_start_backwards(char const * source, size_t * pos)
+{
+    size_t depth = 0;
+
+    while (*pos > 0) {
+        --(*pos);
+        switch (source[*pos]) {
+        case JC_CHAR_DQUOTE:
+            do {
+                if (*pos == 0) {
+                    return 0;
+                }
+                --(*pos);
+            } while (source[*pos] != JC_CHAR_DQUOTE
+                     || jc_is_escaped_backwards(source, *pos));
+            break;
+        case JC_CHAR_OBJECT_END:
+        case JC_CHAR_ARRAY_END:
+            ++depth;
+            break;
+        case JC_CHAR_OBJECT_START:
+        case JC_CHAR_ARRAY_START:
+            if (depth == 0) {
+                return source[*pos] == JC_CHAR_ARRAY_START ? 1 : -1;
+            }
+            --depth;
+            break;
+        case JC_CHAR_COMMA:
+            if (depth == 0) {
+                return 1;
+            }
+            break;
+        default:
+            break;
+        }
+    }
+
+    return 0;
+}
+
+jc_result jc_find_last_elements(char const * source, size_t len,
+                                jc_token * elements, size_t max_elements,
+                                size_t * num_elements)
+{
+    size_t pos = len;
+    size_t end = 0;
+    size_t start = 0;
+    size_t i = 0;
+    jc_token element;
+    int found = 1;
+
+    *num_elements = 0;
+    while (pos > 0 && isspace(source[pos - 1])) {
+        --pos;
+    }
+    if (pos > 0 && source[pos - 1] == JC_CHAR_ARRAY_END) {
+        --pos;
+    } else if (pos > 0 && source[pos - 1] == JC_CHAR_COMMA) {
+        --pos;
+    }
+
+    while (*num_elements < max_elements) {
+        end = pos;
+        found = jc_search_element_start_backwards(source, &pos);
+        if (found < 0) {
+            return JC_RESULT_ERR_UNEXPECTED_TOKEN;
+        } else if (found == 0) {
+            break;
+        }
+
+        start = pos + 1;
+        while (start < end && isspace(source[start])) {
+            ++start;
+        }
+        while (end > start && isspace(source[end - 1])) {
+            --end;
+        }
+
+        if (start == end) {
+            if (source[pos] == JC_CHAR_ARRAY_START && *num_elements == 0) {
+                break;
+            }
+            return JC_RESULT_ERR_UNEXPECTED_TOKEN;
+        }
+
+        elements[*num_elements].type = jc_get_value_type(source[start]);
+        elements[*num_elements].start = start;
+        elements[*num_elements].end = end;
+        ++(*num_elements);
+
+        if (source[pos] == JC_CHAR_ARRAY_START) {
+            break;
+        }
+    }
+
+    /* Elements were found from the last one, restore source order */
+    for (i = 0; i < *num_elements / 2; ++i) {
+        element = elements[i];
+        elements[i] = elements[*num_elements - i - 1];
+        elements[*num_elements - i - 1] = element;
+    }
+
+    return (found == 0) ? JC_RESULT_ERR_UNEXPECTED_EOF : JC_RESULT_OK;
+}
+
+/*
+ * Guesses whether `offset` is inside of a string from the context of the
+ * closest unescaped double quote before it: an opening double quote is preceded
+ * by a bracket, comma or colon, and is not followed by one.
+ */
+int jc_guess_inside_string(char const * source, size_t len, size_t offset)
+{
+    size_t window_start = (offset > JC_RESYNC_WINDOW)
+                        ? offset - JC_RESYNC_WINDOW
+                        : 0;
+    size_t dquote_pos = offset;
+    size_t pos = 0;
+
+    do {
+        if (dquote_pos == window_start) {
+            return 0;
+        }
+        --dquote_pos;
+    } while (source[dquote_pos] != JC_CHAR_DQUOTE
+             || jc_is_escaped_backwards(source, dquote_pos));
+
+    pos = dquote_pos + 1;
+    while (pos < len && isspace(source[pos])) {
+        ++pos;
+    }
+    if (pos < len && strchr(":,]}", source[pos]) != NULL) {
+        return 0;
+    }
+
+    pos = dquote_pos;
+    while (pos > 0 && isspace(source[pos - 1])) {
+        --pos;
+    }
+    return pos > 0 && strchr("{[,:", source[pos - 1]) != NULL;
+}
+
+/*
+ * Moves the state from `offset` to the closest point after which the grammar is
+ * known, and verifies that tokenizing from there succeeds if `verify` is set.
+ */
+jc_result jc_resync(jc_state * state, size_t offset, int inside_string,
+                    int verify)
+{
+    jc_state verifier;
+    jc_result result = JC_RESULT_OK;
+    size_t pos = offset;
+    size_t i = 0;
+
+    if (inside_string) {
+        if (jc_is_escaped_backwards(state->source, pos)) {
+            ++pos;
+        }
+        if (!jc_search_dquote(state, &pos)) {
+            return JC_RESULT_ERR_CANT_INIT;
+        }
+        ++pos;
+    }
+
+    state->nesting_level = 0;
+    state->nesting_stack[0] = JC_NESTING_TYPE_UNKNOWN;
+    state->flags |= JC_STATE_FLAG_RESYNCED;
+
+    for (;; ++pos) {
+        switch (jc_char_at(state, pos)) {
+        case JC_CHAR_NULL:
+            return JC_RESULT_ERR_CANT_INIT;
+        case JC_CHAR_DQUOTE:
+            ++pos;
+            if (!jc_search_dquote(state, &pos)) {
+                return JC_RESULT_ERR_CANT_INIT;
+            }
+            continue;
+        case JC_CHAR_COMMA:
+            ++pos;
+            jc_expect_next(state,
+                JC_TOKEN_TYPE_FIELD_NAME | JC_TOKEN_TYPE_VALUE);
+            break;
+        case JC_CHAR_COLON:
+            ++pos;
+            state->nesting_stack[0] = JC_NESTING_TYPE_OBJECT;
+            jc_expect_next(state, JC_TOKEN_TYPE_VALUE);
+            break;
+        case JC_CHAR_OBJECT_START:
+        case JC_CHAR_ARRAY_START:
+            jc_expect_next(state, JC_TOKEN_TYPE_VALUE);
+            break;
+        case JC_CHAR_OBJECT_END:
+        case JC_CHAR_ARRAY_END:
+            jc_expect_next(state,
+                jc_get_end_token_type_of_current_nesting(state));
+            break;
+        default:
+            continue;
+        }
+        break;
+    }
+
+    state->source_pos = pos;
+    if (!verify) {
+        return JC_RESULT_OK;
+    }
+
+    /* A wrong guess is only detected by grammar checks */
+    verifier = *state;
+    verifier.flags &= ~JC_STATE_FLAG_TRUSTED;
+    for (i = 0; i < JC_RESYNC_VERIFY_TOKENS && result == JC_RESULT_OK; ++i) {
+        result = jc_next_token(&verifier, NULL);
+    }
+    return (result == JC_RESULT_OK || result == JC_RESULT_EOF)
+        ? JC_RESULT_OK
+        : JC_RESULT_ERR_CANT_INIT;
+}
+
+jc_result jc_init_at(jc_state * state, char const * const source, size_t len,
+                     size_t offset, jc_offset_hint hint)
+{
+    int inside_string = (hint == JC_OFFSET_HINT_INSIDE_STRING);
+
+    if (jc_init_n(state, source, len) != JC_RESULT_OK) {
+        return JC_RESULT_ERR_CANT_INIT;
+    } else if (offset > len) {
+        return jc_init(state, NULL);
+    } else if (offset == 0) {
+        return JC_RESULT_OK;
+    } else if (hint != JC_OFFSET_HINT_NONE) {
+        return jc_resync(state, offset, inside_string, 0);
+    }
+
+    inside_string = jc_guess_inside_string(source, len, offset);
+    if (jc_resync(state, offset, inside_string, 1) == JC_RESULT_OK) {
+        return JC_RESULT_OK;
+    }
+
+    jc_init_n(state, source, len);
+    return jc_resync(state, offset, !inside_string, 1);
+}
+
+size_t jc_find_record_end(char const * source, size_t len, size_t pos)
+{
+    char const * newline = NULL;
+    char const * dquote = NULL;
+
+    while (pos < len) {
+        newline = memchr(source + pos, '\n', len - pos);
+        if (newline == NULL) {
+            newline = source + len;
+        }
+
+        dquote = memchr(source + pos, JC_CHAR_DQUOTE, newline - source - pos);
+        if (dquote == NULL) {
+            return newline - source;
+        }
+
+        /* Skip the string, which may contain newlines */
+        for (pos = dquote - source + 1; pos < len; ++pos) {
+            if (source[pos] == JC_CHAR_BACKSLASH) {
+                ++pos;
+            } else if (source[pos] == JC_CHAR_DQUOTE) {
+                break;
+            }
+        }
+        ++pos;
+    }
+
+    return len;
+}
+
+int jc_next_record(char const * source, size_t len, size_t * pos,
+                   size_t * start, size_t * end)
+{
+    while (*pos < len) {
+        *end = jc_find_record_end(source, len, *pos);
+        *start = *pos;
+        *pos = *end + 1;
+
+        while (*start < *end && isspace(source[*start])) {
+            ++(*start);
+        }
+        if (*start < *end) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+size_t jc_count_records(char const * source, size_t len)
+{
+    size_t num_records = 0;
+    size_t pos = 0;
+    size_t start = 0;
+    size_t end = 0;
+
+    while (jc_next_record(source, len, &pos, &start, &end)) {
+        ++num_records;
+    }
+
+    return num_records;
+}
+
+/*
+ * Returns the next number of a 32-bit xorshift pseudo-random sequence
+ */
+unsigned long jc_next_random(unsigned long * random)
+{
+    *random ^= (*random << 13) & JC_HASH_MASK;
+    *random ^= *random >> 17;
+    *random ^= (*random << 5) & JC_HASH_MASK;
+    return *random;
+}
+
+/*
+ * Seeds the xorshift generator; the seed is scrambled first, as the first
+ * numbers generated from small seeds are small as well
+ */
+void jc_seed_random(unsigned long * random, unsigned long seed)
+{
+    int i = 0;
+
+    *random = (seed * JC_RANDOM_SEED_SCRAMBLER) & JC_HASH_MASK;
+    if (*random == 0) {
+        *random = JC_RANDOM_DEFAULT_SEED;
+    }
+    for (i = 0; i < 4; ++i) {
+        jc_next_random(random);
+    }
+}
+
+void jc_sampler_init_every(jc_sampler * sampler, char const * source,
+                           size_t len, size_t k)
+{
+    sampler->source = source;
+    sampler->len = len;
+    sampler->pos = 0;
+    sampler->record_index = 0;
+    sampler->mode = JC_SAMPLE_EVERY_KTH;
+    sampler->every_kth = (k == 0) ? 1 : k;
+    sampler->threshold = 0;
+    sampler->random = 0;
+}
+
+void jc_sampler_init_fraction(jc_sampler * sampler, char const * source,
+                              size_t len, double fraction, unsigned long seed)
+{
+    jc_sampler_init_every(sampler, source, len, 1);
+    sampler->mode = JC_SAMPLE_FRACTION;
+    sampler->threshold = (fraction >= 1.0)
+                       ? JC_HASH_MASK
+                       : (fraction <= 0.0)
+                       ? 0
+                       : (unsigned long) (fraction * JC_HASH_MASK);
+    jc_seed_random(&sampler->random, seed);
+}
+
+jc_result jc_sampler_next(jc_sampler * sampler, jc_state * state,
+                          size_t * record_index)
+{
+    size_t start = 0;
+    size_t end = 0;
+    int is_selected = 0;
+
+    while (jc_next_record(sampler->source, sampler->len, &sampler->pos,
+                          &start, &end)) {
+        if (sampler->mode == JC_SAMPLE_EVERY_KTH) {
+            is_selected = sampler->record_index % sampler->every_kth == 0;
+        } else {
+            is_selected = jc_next_random(&sampler->random) < sampler->threshold;
+        }
+
+        ++(sampler->record_index);
+        if (is_selected) {
+            if (record_index != NULL) {
+                *record_index = sampler->record_index - 1;
+            }
+            return jc_init_span(state, sampler->source, start, end);
+        }
+    }
+
+    return JC_RESULT_EOF;
+}
+
+size_t jc_sample_reservoir(char const * source, size_t len, size_t k,
+                           unsigned long seed, jc_token * records)
+{
+    unsigned long random = 0;
+    size_t num_records = 0;
+    size_t pos = 0;
+    size_t start = 0;
+    size_t end = 0;
+    size_t slot = 0;
+
+    jc_seed_random(&random, seed);
+    while (jc_next_record(source, len, &pos, &start, &end)) {
+        slot = (num_records < k)
+             ? num_records
+             : jc_next_random(&random) % (num_records + 1);
+        ++num_records;
+
+        if (slot < k) {
+            records[slot].type = jc_get_value_type(source[start]);
+            records[slot].start = start;
+            records[slot].end = end;
+        }
+    }
+
+    return (num_records < k) ? num_records : k;
+}
+
+/*
+ * Stores an unsigned LEB128 varint encoding of a value into `data` and returns
+ * its length
+ */
+size_t jc_encode_varint(size_t value, unsigned char * data)
+{
+    size_t len = 0;
+
+    while (value >= 0x80) {
+        data[len++] = (unsigned char) (value | 0x80);
+        value >>= 7;
+    }
+    data[len++] = (unsigned char) value;
+    return len;
+}
+
+/*
+ * Decodes a varint from `data` of given length into `value` and returns its
+ * length, or 0 if it's truncated
+ */
+size_t jc_decode_varint(unsigned char const * data, size_t len, size_t * value)
+{
+    size_t i = 0;
+
+    *value = 0;
+    for (i = 0; i < len && i < JC_MAX_VARINT_SIZE; ++i) {
+        *value |= (size_t) (data[i] & 0x7F) << (7 * i);
+        if (!(data[i] & 0x80)) {
+            return i + 1;
+        }
+    }
+
+    return 0;
+}
+
+void jc_record_index_init(jc_record_index * index,
+                          jc_record_checkpoint * checkpoints,
+                          size_t max_checkpoints, unsigned char * deltas,
+                          size_t deltas_size, size_t interval)
+{
+    index->checkpoints = checkpoints;
+    index->max_checkpoints = max_checkpoints;
+    index->num_checkpoints = 0;
+    index->deltas = deltas;
+    index->deltas_size = deltas_size;
+    index->deltas_len = 0;
+    index->interval = (interval == 0) ? 1 : interval;
+    index->num_records = 0;
+    index->last_offset = 0;
+}
+
+jc_result jc_record_index_add(jc_record_index * index, size_t offset)
+{
+    unsigned char varint[JC_MAX_VARINT_SIZE];
+    size_t varint_len = 0;
+    jc_record_checkpoint * checkpoint = NULL;
+
+    if (index->num_records % index->interval == 0) {
+        if (index->num_checkpoints == index->max_checkpoints) {
+            return JC_RESULT_ERR_BUFFER_FULL;
+        }
+
+        checkpoint = &index->checkpoints[index->num_checkpoints++];
+        checkpoint->offset = offset;
+        checkpoint->delta_pos = index->deltas_len;
+    } else {
+        varint_len = jc_encode_varint(offset - index->last_offset, varint);
+        if (index->deltas_size - index->deltas_len < varint_len) {
+            return JC_RESULT_ERR_BUFFER_FULL;
+        }
+
+        memcpy(index->deltas + index->deltas_len, varint, varint_len);
+        index->deltas_len += varint_len;
+    }
+
+    index->last_offset = offset;
+    ++(index->num_records);
+    return JC_RESULT_OK;
+}
+
+jc_result jc_record_index_build(jc_record_index * index, char const * source,
+                                size_t len)
+{
+    jc_result result = JC_RESULT_OK;
+    size_t pos = 0;
+    size_t start = 0;
+    size_t end = 0;
+
+    if (index->num_records > 0) {
+        pos = jc_find_record_end(source, len, index->last_offset) + 1;
+    }
+
+    while (jc_next_record(source, len, &pos, &start, &end)) {
+        result = jc_record_index_add(index, start);
+        if (result != JC_RESULT_OK) {
+            return result;
+        }
+    }
+
+    return JC_RESULT_OK;
+}
+
+jc_result jc_record_index_get(jc_record_index const * index, size_t record,
+                              size_t * offset)
+{
+    jc_record_checkpoint const * checkpoint = NULL;
+    size_t pos = 0;
+    size_t delta = 0;
+    size_t varint_len = 0;
+    size_t i = 0;
+
+    if (record >= index->num_records) {
+        return JC_RESULT_EOF;
+    } else if (record / index->interval >= index->num_checkpoints) {
+        return JC_RESULT_ERR_CORRUPTED_STATE;
+    }
+
+    checkpoint = &index->checkpoints[record / index->interval];
+    *offset = checkpoint->offset;
+    pos = checkpoint->delta_pos;
+    for (i = 0; i < record % index->interval; ++i) {
+        varint_len = (pos < index->deltas_len)
+                   ? jc_decode_varint(index->deltas + pos,
+                                      index->deltas_len - pos, &delta)
+                   : 0;
+        if (varint_len == 0) {
+            return JC_RESULT_ERR_CORRUPTED_STATE;
+        }
+
+        pos += varint_len;
+        *offset += delta;
+    }
+
+    return JC_RESULT_OK;
+}
+
+void jc_set_max_emit_depth(jc_state * state, int depth)
+{
+    state->max_emit_depth = (depth < 0) ? JC_NO_MAX_EMIT_DEPTH : depth;
+}
+
+void jc_set_trusted_input(jc_state * state, int trusted)
+{
+    if (trusted) {
+        state->flags |= JC_STATE_FLAG_TRUSTED;
+    } else {
+        state->flags &= ~JC_STATE_FLAG_TRUSTED;
+    }
+}
+
+jc_result jc_tokenize(jc_state * state, jc_token * tokens, size_t max_tokens,
+                      size_t * num_tokens)
+{
+    jc_result result = JC_RESULT_OK;
+
+    *num_tokens = 0;
+    while (*num_tokens < max_tokens) {
+        result = jc_next_token(state, tokens + *num_tokens);
+        if (result != JC_RESULT_OK) {
+            return (result == JC_RESULT_EOF) ? JC_RESULT_OK : result;
+        }
+        ++(*num_tokens);
+    }
+
+    /* Buffer is full: make sure there is actually a token left */
+    result = jc_peek_token(state, NULL);
+    if (result == JC_RESULT_OK) {
+        return JC_RESULT_ERR_BUFFER_FULL;
+    }
+    return (result == JC_RESULT_EOF) ? JC_RESULT_OK : result;
+}
+
+size_t jc_tokenize_batch(jc_document const * documents, size_t num_documents,
+                         jc_token * tokens, size_t max_tokens,
+                         jc_document_tokens * ranges)
+{
+    jc_state state;
+    size_t i = 0;
+    size_t used_tokens = 0;
+
+    for (i = 0; i < num_documents; ++i) {
+        ranges[i].first_token = used_tokens;
+        ranges[i].result = jc_init_n(&state, documents[i].source,
+                                     documents[i].len);
+        if (ranges[i].result == JC_RESULT_OK) {
+            ranges[i].result = jc_tokenize(&state, tokens + used_tokens,
+                                           max_tokens - used_tokens,
+                                           &ranges[i].num_tokens);
+        } else {
+            ranges[i].num_tokens = 0;
+        }
+
+        used_tokens += ranges[i].num_tokens;
+        if (ranges[i].result == JC_RESULT_ERR_BUFFER_FULL) {
+            return i + 1;
+        }
+    }
 
-jc_result jc_init(jc_state * state, char const * const source)
+    return num_documents;
+}
+
+jc_result jc_cache_init(jc_cache * cache, jc_cache_shard * shards,
+                        size_t num_shards, void * arena, size_t arena_size,
+                        size_t slot_size)
 {
-    if (state == NULL || source == NULL) {
+    size_t i = 0;
+
+    if (cache == NULL || shards == NULL || arena == NULL || num_shards == 0) {
         return JC_RESULT_ERR_CANT_INIT;
     }
 
-    state->source = source;
-    state->source_pos = 0;
-    state->nesting_level = JC_NO_NESTING_LEVEL;
-    state->expected_token_types = JC_TOKEN_TYPE_VALUE;
+    cache->slot_size = slot_size / sizeof(jc_token) * sizeof(jc_token);
+    if (cache->slot_size <= sizeof(jc_cache_slot)) {
+        return JC_RESULT_ERR_CANT_INIT;
+    }
+
+    cache->num_sets = arena_size / num_shards / cache->slot_size / JC_CACHE_WAYS;
+    if (cache->num_sets == 0) {
+        return JC_RESULT_ERR_CANT_INIT;
+    }
+
+    cache->shards = shards;
+    cache->num_shards = num_shards;
+    cache->lock = NULL;
+    cache->unlock = NULL;
+    memset(arena, 0, arena_size);
+    for (i = 0; i < num_shards; ++i) {
+        shards[i].slots = (unsigned char *) arena
+                        + i * cache->num_sets * JC_CACHE_WAYS * cache->slot_size;
+        shards[i].clock = 0;
+        shards[i].hits = 0;
+        shards[i].misses = 0;
+        shards[i].lock = NULL;
+    }
+
     return JC_RESULT_OK;
 }
 
-char const * jc_current_source(jc_state * state)
+void jc_cache_set_locks(jc_cache * cache, jc_lock_fn lock, jc_lock_fn unlock,
+                        void * locks, size_t lock_size)
 {
-    return state->source + state->source_pos;
+    size_t i = 0;
+
+    cache->lock = lock;
+    cache->unlock = unlock;
+    for (i = 0; i < cache->num_shards; ++i) {
+        cache->shards[i].lock = (char *) locks + i * lock_size;
+    }
 }
 
-void jc_make_token(jc_state * state, jc_token * token, jc_token_type type,
-                   size_t len)
+void jc_cache_lock_shard(jc_cache * cache, jc_cache_shard * shard)
 {
-    if (token != NULL) {
-        token->type = type;
-        token->start = state->source_pos;
-        token->end = state->source_pos + len;
+    if (cache->lock != NULL) {
+        cache->lock(shard->lock);
     }
 }
 
-void jc_advance_source_pos(jc_state * state, size_t num_of_chars)
+void jc_cache_unlock_shard(jc_cache * cache, jc_cache_shard * shard)
 {
-    state->source_pos += num_of_chars;
+    if (cache->unlock != NULL) {
+        cache->unlock(shard->lock);
+    }
 }
 
-void jc_expect_next(jc_state * state, size_t expected_token_types)
+jc_cache_slot * jc_cache_slot_at(jc_cache * cache, jc_cache_shard * shard,
+                                 unsigned long hash, size_t way)
 {
-    state->expected_token_types = expected_token_types;
+    size_t set = (hash / cache->num_shards) % cache->num_sets;
+    return (jc_cache_slot *) (shard->slots
+        + (set * JC_CACHE_WAYS + way) * cache->slot_size);
 }
 
-int jc_is_expected(jc_state * state, jc_token_type type)
+jc_token * jc_cache_slot_tokens(jc_cache_slot * slot)
 {
-    if (type == JC_NO_TOKENS_EXPECTED) {
-        return state->expected_token_types == type;
-    } else {
-        return (state->expected_token_types & type) > 0;
-    }
+    return (jc_token *) (slot + 1);
 }
 
-void jc_skip_whitespace(jc_state * state)
+char * jc_cache_slot_source(jc_cache_slot * slot)
 {
-    while (isspace(state->source[state->source_pos])) {
-        ++(state->source_pos);
-    }
+    return (char *) (jc_cache_slot_tokens(slot) + slot->num_tokens);
 }
 
-jc_result jc_nest(jc_state * state, jc_nesting_type type)
+jc_result jc_cache_tokenize(jc_cache * cache, char const * source, size_t len,
+                            jc_token * tokens, size_t max_tokens,
+                            size_t * num_tokens)
 {
-    if (state->nesting_level >= JC_MAX_NESTING_LEVEL - 1) {
-        return JC_RESULT_ERR_MAX_NESTING_REACHED;
+    unsigned long hash = jc_hash(JC_HASH_INIT, source, len);
+    jc_cache_shard * shard = &cache->shards[hash % cache->num_shards];
+    jc_cache_slot * slot = NULL;
+    jc_cache_slot * victim = NULL;
+    jc_state state;
+    jc_result result;
+    size_t way = 0;
+
+    jc_cache_lock_shard(cache, shard);
+    ++(shard->clock);
+    for (way = 0; way < JC_CACHE_WAYS; ++way) {
+        slot = jc_cache_slot_at(cache, shard, hash, way);
+        if (slot->last_used != 0 && slot->hash == hash
+                && slot->source_len == len && slot->num_tokens <= max_tokens
+                && memcmp(jc_cache_slot_source(slot), source, len) == 0) {
+            slot->last_used = shard->clock;
+            ++(shard->hits);
+            *num_tokens = slot->num_tokens;
+            memcpy(tokens, jc_cache_slot_tokens(slot),
+                   slot->num_tokens * sizeof(jc_token));
+            jc_cache_unlock_shard(cache, shard);
+            return JC_RESULT_OK;
+        }
+    }
+    ++(shard->misses);
+    jc_cache_unlock_shard(cache, shard);
+
+    jc_init_n(&state, source, len);
+    result = jc_tokenize(&state, tokens, max_tokens, num_tokens);
+    if (result != JC_RESULT_OK || sizeof(jc_cache_slot)
+            + *num_tokens * sizeof(jc_token) + len > cache->slot_size) {
+        return result;
     }
 
-    state->nesting_level += 1;
-    state->nesting_stack[state->nesting_level] = type;
-    return JC_RESULT_OK;
+    jc_cache_lock_shard(cache, shard);
+    for (way = 0; way < JC_CACHE_WAYS; ++way) {
+        slot = jc_cache_slot_at(cache, shard, hash, way);
+        if (victim == NULL || slot->last_used < victim->last_used) {
+            victim = slot;
+        }
+    }
+
+    victim->hash = hash;
+    victim->last_used = ++(shard->clock);
+    victim->source_len = len;
+    victim->num_tokens = *num_tokens;
+    memcpy(jc_cache_slot_tokens(victim), tokens,
+           *num_tokens * sizeof(jc_token));
+    memcpy(jc_cache_slot_source(victim), source, len);
+    jc_cache_unlock_shard(cache, shard);
+    return result;
 }
 
-jc_result jc_unnest(jc_state * state)
+void jc_cache_stats(jc_cache * cache, unsigned long * hits,
+                    unsigned long * misses)
 {
-    if (state->nesting_level <= JC_NO_NESTING_LEVEL) {
-        return JC_RESULT_ERR_CORRUPTED_STATE;
+    size_t i = 0;
+
+    *hits = 0;
+    *misses = 0;
+    for (i = 0; i < cache->num_shards; ++i) {
+        jc_cache_lock_shard(cache, &cache->shards[i]);
+        *hits += cache->shards[i].hits;
+        *misses += cache->shards[i].misses;
+        jc_cache_unlock_shard(cache, &cache->shards[i]);
     }
+}
 
-    state->nesting_level -= 1;
+jc_result jc_dict_init(jc_dict * dict, void * arena, size_t arena_size,
+                       size_t max_entries)
+{
+    size_t num_slots = 1;
+    size_t table_size = 0;
+
+    if (dict == NULL || arena == NULL || max_entries == 0
+            || max_entries > arena_size) {
+        return JC_RESULT_ERR_CANT_INIT;
+    }
+
+    /* Keep the table at most three quarters full, so probes stay short */
+    while (num_slots * 3 < max_entries * 4) {
+        num_slots *= 2;
+    }
+
+    table_size = max_entries * sizeof(jc_dict_entry)
+               + num_slots * sizeof(size_t);
+    if (arena_size <= table_size) {
+        return JC_RESULT_ERR_CANT_INIT;
+    }
+
+    dict->entries = (jc_dict_entry *) arena;
+    dict->max_entries = max_entries;
+    dict->num_entries = 0;
+    dict->slots = (size_t *) (dict->entries + max_entries);
+    dict->num_slots = num_slots;
+    dict->strings = (char *) (dict->slots + num_slots);
+    dict->strings_size = arena_size - table_size;
+    dict->strings_len = 0;
+    memset(dict->slots, 0, num_slots * sizeof(size_t));
     return JC_RESULT_OK;
 }
 
-jc_token_type jc_get_end_token_type_of_current_nesting(jc_state * state)
+unsigned long jc_mix_hash(unsigned long hash)
 {
-    if (JC_NO_NESTING_LEVEL < state->nesting_level
-            && state->nesting_level < JC_MAX_NESTING_LEVEL) {
-        if (state->nesting_stack[state->nesting_level]
-                == JC_NESTING_TYPE_OBJECT) {
-            return JC_TOKEN_TYPE_COMMA | JC_TOKEN_TYPE_OBJECT_END;
-        } else {
-            return JC_TOKEN_TYPE_COMMA | JC_TOKEN_TYPE_ARRAY_END;
+    hash = ((hash ^ (hash >> 16)) * 0x85EBCA6BUL) & JC_HASH_MASK;
+    hash = ((hash ^ (hash >> 13)) * 0xC2B2AE35UL) & JC_HASH_MASK;
+    return hash ^ (hash >> 16);
+}
+
+jc_result jc_dict_encode(jc_dict * dict, char const * data, size_t len,
+                         size_t * code)
+{
+    unsigned long hash = jc_hash(JC_HASH_INIT, data, len);
+    size_t mask = dict->num_slots - 1;
+    size_t slot = jc_mix_hash(hash) & mask;
+    jc_dict_entry * entry = NULL;
+
+    /* Slots hold codes plus one, so that zero marks empty slots */
+    for (; dict->slots[slot] != 0; slot = (slot + 1) & mask) {
+        entry = &dict->entries[dict->slots[slot] - 1];
+        if (entry->hash == hash && entry->len == len
+                && memcmp(dict->strings + entry->offset, data, len) == 0) {
+            *code = dict->slots[slot] - 1;
+            return JC_RESULT_OK;
         }
-    } else {
-        return JC_NO_TOKENS_EXPECTED;
     }
+
+    if (dict->num_entries == dict->max_entries
+            || dict->strings_size - dict->strings_len < len) {
+        return JC_RESULT_ERR_BUFFER_FULL;
+    }
+
+    entry = &dict->entries[dict->num_entries];
+    entry->offset = dict->strings_len;
+    entry->len = len;
+    entry->hash = hash;
+    memcpy(dict->strings + dict->strings_len, data, len);
+    dict->strings_len += len;
+
+    *code = dict->num_entries++;
+    dict->slots[slot] = *code + 1;
+    return JC_RESULT_OK;
 }
 
-jc_token_type jc_get_token_type_after_comma_of_current_nesting(jc_state * state)
+jc_result jc_dict_decode(jc_dict const * dict, size_t code, char const ** data,
+                         size_t * len)
 {
-    if (JC_NO_NESTING_LEVEL < state->nesting_level
-            && state->nesting_level < JC_MAX_NESTING_LEVEL) {
-        if (state->nesting_stack[state->nesting_level]
-                == JC_NESTING_TYPE_OBJECT) {
-            return JC_TOKEN_TYPE_FIELD_NAME;
-        } else {
-            return JC_TOKEN_TYPE_VALUE;
-        }
-    } else {
-        return JC_NO_TOKENS_EXPECTED;
+    if (code >= dict->num_entries) {
+        return JC_RESULT_EOF;
     }
+
+    *data = dict->strings + dict->entries[code].offset;
+    *len = dict->entries[code].len;
+    return JC_RESULT_OK;
 }
 
-char const * jc_search_dquote(char const * str)
+void jc_packed_tape_init(jc_packed_tape * tape, unsigned char * types,
+                         size_t types_size, unsigned char * data,
+                         size_t data_size, jc_packed_checkpoint * checkpoints,
+                         size_t max_checkpoints, size_t interval)
 {
-    char const * c = str;
+    tape->types = types;
+    tape->types_size = types_size;
+    tape->data = data;
+    tape->data_size = data_size;
+    tape->data_len = 0;
+    tape->checkpoints = checkpoints;
+    tape->max_checkpoints = max_checkpoints;
+    tape->num_checkpoints = 0;
+    tape->interval = (interval == 0) ? 1 : interval;
+    tape->num_tokens = 0;
+    tape->last_end = 0;
+}
 
-    while (*c != JC_CHAR_DQUOTE) {
-        if (*c == JC_CHAR_NULL) {
-            c = NULL;
-            break;
-        } else if (*c == JC_CHAR_BACKSLASH && *(c + 1) != JC_CHAR_NULL) {
-            c += 2;
-        } else {
-            c += 1;
-        }
-    }
+/*
+ * Returns the fixed length of tokens with given type code, or 0 if their length
+ * is stored
+ */
+size_t jc_packed_type_len(unsigned int code)
+{
+    static unsigned char const lens[JC_PACKED_TYPE_CODES] = {
+        0, 0, 4, 5, 4, 1, 1, 1, 1, 0, 1, 1
+    };
 
-    return c;
+    return lens[code];
 }
 
-jc_result jc_parse_string_or_field_name(jc_state * state, jc_token * token)
+jc_result jc_packed_tape_add(jc_packed_tape * tape, jc_token const * token)
 {
-    size_t token_len = 0;
-    jc_token_type token_type = JC_TOKEN_TYPE_STRING;
-    char const * end_dquote_ptr = NULL;
+    unsigned char varints[2 * JC_MAX_VARINT_SIZE];
+    size_t varints_len = 0;
+    size_t fixed_len = 0;
+    unsigned int code = 0;
+    jc_packed_checkpoint * checkpoint = NULL;
+
+    while (code < JC_PACKED_TYPE_CODES
+            && (jc_token_type) (1 << code) != token->type) {
+        ++code;
+    }
 
-    end_dquote_ptr = jc_search_dquote(jc_current_source(state) + 1);
-    if (end_dquote_ptr == NULL) {
-        return JC_RESULT_ERR_UNEXPECTED_EOF;
+    if (code == JC_PACKED_TYPE_CODES || token->start < tape->last_end
+            || token->end < token->start) {
+        return JC_RESULT_ERR_UNEXPECTED_TOKEN;
     }
-    token_len = end_dquote_ptr - jc_current_source(state) - 1;
 
-    if (jc_is_expected(state, JC_TOKEN_TYPE_FIELD_NAME)) {
-        token_type = JC_TOKEN_TYPE_FIELD_NAME;
+    fixed_len = jc_packed_type_len(code);
+    if (fixed_len > 0 && token->end - token->start != fixed_len) {
+        return JC_RESULT_ERR_UNEXPECTED_TOKEN;
     }
 
-    jc_advance_source_pos(state, 1);
-    jc_make_token(state, token, token_type, token_len);
-    jc_advance_source_pos(state, token_len + 1);
+    varints_len = jc_encode_varint(token->start - tape->last_end, varints);
+    if (fixed_len == 0) {
+        varints_len += jc_encode_varint(token->end - token->start,
+                                        varints + varints_len);
+    }
 
-    if (token_type == JC_TOKEN_TYPE_FIELD_NAME) {
-        jc_expect_next(state, JC_TOKEN_TYPE_COLON);
-    } else {
-        jc_expect_next(state,
-            jc_get_end_token_type_of_current_nesting(state));
+    if (tape->num_tokens / 2 >= tape->types_size
+            || tape->data_size - tape->data_len < varints_len
+            || (tape->num_tokens % tape->interval == 0
+                && tape->num_checkpoints == tape->max_checkpoints)) {
+        return JC_RESULT_ERR_BUFFER_FULL;
     }
-    return JC_RESULT_OK;
-}
 
-jc_result jc_parse_number(jc_state * state, jc_token * token)
-{
-    size_t token_len = 0;
-    while (strchr(JC_VALID_CHARS_IN_NUMBER,
-                  *(jc_current_source(state) + token_len)) != NULL) {
-        ++token_len;
+    if (tape->num_tokens % tape->interval == 0) {
+        checkpoint = &tape->checkpoints[tape->num_checkpoints++];
+        checkpoint->base = tape->last_end;
+        checkpoint->data_pos = tape->data_len;
     }
 
-    jc_make_token(state, token, JC_TOKEN_TYPE_NUMBER, token_len);
-    jc_advance_source_pos(state, token_len);
-    jc_expect_next(state, jc_get_end_token_type_of_current_nesting(state));
+    if (tape->num_tokens % 2 == 0) {
+        tape->types[tape->num_tokens / 2] = (unsigned char) code;
+    } else {
+        tape->types[tape->num_tokens / 2] |= (unsigned char) (code << 4);
+    }
+
+    memcpy(tape->data + tape->data_len, varints, varints_len);
+    tape->data_len += varints_len;
+    tape->last_end = token->end;
+    ++(tape->num_tokens);
     return JC_RESULT_OK;
 }
 
-jc_result jc_parse_literal(jc_state * state, jc_token * token,
-                           jc_token_type token_type, char const * literal)
+/*
+ * Decodes a varint of the tape at `pos` into `value` and advances `pos` past
+ * it. Returns 0 if it's truncated.
+ */
+int jc_packed_tape_varint(jc_packed_tape const * tape, size_t * pos,
+                          size_t * value)
 {
-    size_t token_len = strlen(literal);
-    if (strncmp(jc_current_source(state), literal, token_len) != 0) {
-        return JC_RESULT_ERR_UNEXPECTED_TOKEN;
+    size_t len = 0;
+
+    if (*pos < tape->data_len && tape->data[*pos] < 0x80) {
+        *value = tape->data[(*pos)++];
+        return 1;
     }
 
-    jc_make_token(state, token, token_type, token_len);
-    jc_advance_source_pos(state, token_len);
-    jc_expect_next(state, jc_get_end_token_type_of_current_nesting(state));
-    return JC_RESULT_OK;
+    len = (*pos < tape->data_len)
+        ? jc_decode_varint(tape->data + *pos, tape->data_len - *pos, value)
+        : 0;
+    *pos += len;
+    return len > 0;
 }
 
-jc_result jc_next_token(jc_state * state, jc_token * token)
+jc_result jc_packed_tape_read(jc_packed_reader * reader, jc_token * tokens,
+                              size_t max_tokens, size_t * num_tokens)
 {
-    char current_char = '\0';
-
-    if (state == NULL) {
-        return JC_RESULT_ERR_CORRUPTED_STATE;
+    jc_packed_tape const * tape = reader->tape;
+    size_t index = reader->token;
+    size_t pos = reader->data_pos;
+    size_t last_end = reader->last_end;
+    size_t end = tape->num_tokens;
+    size_t delta = 0;
+    size_t len = 0;
+    unsigned int code = 0;
+    jc_result result = JC_RESULT_OK;
+
+    *num_tokens = 0;
+    if (index >= tape->num_tokens) {
+        return JC_RESULT_EOF;
+    } else if (max_tokens < end - index) {
+        end = index + max_tokens;
     }
 
-    jc_skip_whitespace(state);
-    current_char = state->source[state->source_pos];
+    for (; index < end; ++index, ++tokens) {
+        code = (tape->types[index / 2] >> ((index % 2) * 4)) & 0x0F;
+        if (code >= JC_PACKED_TYPE_CODES
+                || !jc_packed_tape_varint(tape, &pos, &delta)) {
+            result = JC_RESULT_ERR_CORRUPTED_STATE;
+            break;
+        }
 
-    /* Check for EOF */
+        len = jc_packed_type_len(code);
+        if (len == 0 && !jc_packed_tape_varint(tape, &pos, &len)) {
+            result = JC_RESULT_ERR_CORRUPTED_STATE;
+            break;
+        }
 
-    if (jc_is_expected(state, JC_NO_TOKENS_EXPECTED)) {
-        return (current_char == JC_CHAR_NULL)
-            ? JC_RESULT_EOF
-            : JC_RESULT_ERR_GARBAGE;
-    } else if (current_char == JC_CHAR_NULL) {
-        return JC_RESULT_ERR_UNEXPECTED_EOF;
+        tokens->type = (jc_token_type) (1 << code);
+        tokens->start = last_end + delta;
+        tokens->end = tokens->start + len;
+        last_end = tokens->end;
     }
 
-    /* Parse object start */
+    *num_tokens = index - reader->token;
+    reader->token = index;
+    reader->data_pos = pos;
+    reader->last_end = last_end;
+    return result;
+}
 
-    if (jc_is_expected(state, JC_TOKEN_TYPE_OBJECT_START)
-            && current_char == JC_CHAR_OBJECT_START) {
-        jc_make_token(state, token, JC_TOKEN_TYPE_OBJECT_START, 1);
-        jc_advance_source_pos(state, 1);
-        jc_expect_next(state,
-            JC_TOKEN_TYPE_FIELD_NAME | JC_TOKEN_TYPE_OBJECT_END);
-        return jc_nest(state, JC_NESTING_TYPE_OBJECT);
+jc_result jc_packed_tape_seek(jc_packed_tape const * tape, size_t token,
+                              jc_packed_reader * reader)
+{
+    jc_packed_checkpoint const * checkpoint = NULL;
+    jc_token skipped;
+    size_t num_skipped = 0;
+
+    if (token > tape->num_tokens) {
+        return JC_RESULT_EOF;
+    } else if (token / tape->interval > tape->num_checkpoints) {
+        return JC_RESULT_ERR_CORRUPTED_STATE;
     }
 
-    /* Parse array start */
+    reader->tape = tape;
+    reader->token = token - token % tape->interval;
+    reader->data_pos = tape->data_len;
+    reader->last_end = tape->last_end;
+    if (token / tape->interval < tape->num_checkpoints) {
+        checkpoint = &tape->checkpoints[token / tape->interval];
+        reader->data_pos = checkpoint->data_pos;
+        reader->last_end = checkpoint->base;
+    }
 
-    if (jc_is_expected(state, JC_TOKEN_TYPE_ARRAY_START)
-            && current_char == JC_CHAR_ARRAY_START) {
-        jc_make_token(state, token, JC_TOKEN_TYPE_ARRAY_START, 1);
-        jc_advance_source_pos(state, 1);
-        jc_expect_next(state, JC_TOKEN_TYPE_VALUE | JC_TOKEN_TYPE_ARRAY_END);
-        return jc_nest(state, JC_NESTING_TYPE_ARRAY);
+    while (reader->token < token) {
+        if (jc_packed_tape_read(reader, &skipped, 1, &num_skipped)
+                != JC_RESULT_OK) {
+            return JC_RESULT_ERR_CORRUPTED_STATE;
+        }
     }
 
-    /* Parse object end */
+    return JC_RESULT_OK;
+}
 
-    if (jc_is_expected(state, JC_TOKEN_TYPE_OBJECT_END)
-            && current_char == JC_CHAR_OBJECT_END) {
-        jc_make_token(state, token, JC_TOKEN_TYPE_OBJECT_END, 1);
-        jc_advance_source_pos(state, 1);
+void jc_tape_index_init(jc_tape_index * index, char const * source,
+                        jc_token const * tokens, size_t num_tokens,
+                        jc_tape_object * objects, size_t max_objects,
+                        jc_tape_slot * slots, size_t max_slots,
+                        size_t min_members, unsigned long threshold)
+{
+    index->source = source;
+    index->tokens = tokens;
+    index->num_tokens = num_tokens;
+    index->objects = objects;
+    index->max_objects = max_objects;
+    index->num_objects = 0;
+    index->slots = slots;
+    index->max_slots = max_slots;
+    index->num_slots = 0;
+    index->min_members = min_members;
+    index->threshold = threshold;
+    memset(objects, 0, max_objects * sizeof(jc_tape_object));
+}
 
-        if (jc_unnest(state) != JC_RESULT_OK) {
-            return JC_RESULT_ERR_CORRUPTED_STATE;
+/*
+ * Returns the tape position after the value at `pos`, or the number of tokens
+ * if it's truncated
+ */
+size_t jc_tape_skip_value(jc_tape_index const * index, size_t pos)
+{
+    size_t depth = 0;
+
+    do {
+        if (index->tokens[pos].type & (JC_TOKEN_TYPE_OBJECT_START
+                                       | JC_TOKEN_TYPE_ARRAY_START)) {
+            ++depth;
+        } else if (index->tokens[pos].type & (JC_TOKEN_TYPE_OBJECT_END
+                                              | JC_TOKEN_TYPE_ARRAY_END)) {
+            --depth;
         }
+        ++pos;
+    } while (depth > 0 && pos < index->num_tokens);
 
-        jc_expect_next(state, jc_get_end_token_type_of_current_nesting(state));
-        return JC_RESULT_OK;
+    return depth > 0 ? index->num_tokens : pos;
+}
+
+/*
+ * Stores the tape position of the next member of an object, starting at `pos`,
+ * into `member`, or the position of the object end if there are no more
+ * members. Returns 0 if the object is malformed.
+ */
+int jc_tape_next_member(jc_tape_index const * index, size_t pos,
+                        size_t * member)
+{
+    if (pos < index->num_tokens
+            && index->tokens[pos].type == JC_TOKEN_TYPE_COMMA) {
+        ++pos;
     }
 
-    /* Parse array end */
+    *member = pos;
+    return pos < index->num_tokens
+        && (index->tokens[pos].type == JC_TOKEN_TYPE_OBJECT_END
+            || (index->tokens[pos].type == JC_TOKEN_TYPE_FIELD_NAME
+                && pos + 2 < index->num_tokens));
+}
 
-    if (jc_is_expected(state, JC_TOKEN_TYPE_ARRAY_END)
-            && current_char == JC_CHAR_ARRAY_END) {
-        jc_make_token(state, token, JC_TOKEN_TYPE_ARRAY_END, 1);
-        jc_advance_source_pos(state, 1);
+int jc_tape_key_equals(jc_tape_index const * index, size_t member,
+                       char const * key, size_t key_len)
+{
+    jc_token const * name = &index->tokens[member];
 
-        if (jc_unnest(state) != JC_RESULT_OK) {
-            return JC_RESULT_ERR_CORRUPTED_STATE;
-        }
+    return name->end - name->start == key_len
+        && memcmp(index->source + name->start, key, key_len) == 0;
+}
 
-        jc_expect_next(state, jc_get_end_token_type_of_current_nesting(state));
-        return JC_RESULT_OK;
+/*
+ * Finds the member slot of a field name in a member index: the slot holding
+ * it, or the empty slot where it belongs
+ */
+jc_tape_slot * jc_tape_probe(jc_tape_index const * index,
+                             jc_tape_object const * record, unsigned long hash,
+                             char const * key, size_t key_len)
+{
+    size_t mask = record->num_slots - 1;
+    size_t slot = jc_mix_hash(hash) & mask;
+    jc_tape_slot * slots = index->slots + record->first_slot;
+
+    while (slots[slot].member != 0
+            && (slots[slot].hash != hash
+                || !jc_tape_key_equals(index, slots[slot].member - 1, key,
+                                       key_len))) {
+        slot = (slot + 1) & mask;
     }
 
-    /* Parse colon */
+    return &slots[slot];
+}
 
-    if (jc_is_expected(state, JC_TOKEN_TYPE_COLON)
-            && current_char == JC_CHAR_COLON) {
-        jc_make_token(state, token, JC_TOKEN_TYPE_COLON, 1);
-        jc_advance_source_pos(state, 1);
-        jc_expect_next(state, JC_TOKEN_TYPE_VALUE);
-        return JC_RESULT_OK;
+/*
+ * Builds the member index of an object if it's large enough and there are
+ * enough slots left; otherwise marks it to be always scanned
+ */
+void jc_tape_build_index(jc_tape_index * index, jc_tape_object * record)
+{
+    jc_token const * name = NULL;
+    jc_tape_slot * slot = NULL;
+    unsigned long hash = 0;
+    size_t num_members = 0;
+    size_t num_slots = 1;
+    size_t pos = 0;
+
+    /* Records hold the object position plus one, where its first member is */
+    record->status = JC_TAPE_OBJECT_SCANNED;
+    for (pos = record->object; jc_tape_next_member(index, pos, &pos)
+            && index->tokens[pos].type == JC_TOKEN_TYPE_FIELD_NAME;
+            pos = jc_tape_skip_value(index, pos + 2)) {
+        ++num_members;
     }
 
-    /* Parse comma */
+    while (num_slots * 3 < num_members * 4) {
+        num_slots *= 2;
+    }
 
-    if (jc_is_expected(state, JC_TOKEN_TYPE_COMMA)
-            && current_char == JC_CHAR_COMMA) {
-        jc_make_token(state, token, JC_TOKEN_TYPE_COMMA, 1);
-        jc_advance_source_pos(state, 1);
-        jc_expect_next(state,
-            jc_get_token_type_after_comma_of_current_nesting(state));
-        return JC_RESULT_OK;
+    if (num_members < index->min_members || pos >= index->num_tokens
+            || index->tokens[pos].type != JC_TOKEN_TYPE_OBJECT_END
+            || index->max_slots - index->num_slots < num_slots) {
+        return;
     }
 
-    /* Parse field name or string */
+    record->first_slot = index->num_slots;
+    record->num_slots = num_slots;
+    index->num_slots += num_slots;
+    memset(index->slots + record->first_slot, 0,
+           num_slots * sizeof(jc_tape_slot));
+
+    for (pos = record->object; jc_tape_next_member(index, pos, &pos)
+            && index->tokens[pos].type == JC_TOKEN_TYPE_FIELD_NAME;
+            pos = jc_tape_skip_value(index, pos + 2)) {
+        name = &index->tokens[pos];
+        hash = jc_hash(JC_HASH_INIT, index->source + name->start,
+                       name->end - name->start);
+        slot = jc_tape_probe(index, record, hash, index->source + name->start,
+                             name->end - name->start);
+        if (slot->member == 0) {
+            slot->hash = hash;
+            slot->member = pos + 1;
+        }
+    }
+    record->status = JC_TAPE_OBJECT_INDEXED;
+}
 
-    if (jc_is_expected(state, JC_TOKEN_TYPE_FIELD_NAME | JC_TOKEN_TYPE_STRING)
-            && current_char == JC_CHAR_DQUOTE) {
-        return jc_parse_string_or_field_name(state, token);
+/*
+ * Returns the record of a looked up object, adding it if there's room, or
+ * NULL if there's none
+ */
+jc_tape_object * jc_tape_find_object(jc_tape_index * index, size_t object)
+{
+    size_t i = 0;
+
+    if (index->max_objects == 0) {
+        return NULL;
     }
 
-    /* Parse number */
+    for (i = jc_mix_hash(object & JC_HASH_MASK) % index->max_objects;
+            index->objects[i].object != 0;
+            i = (i + 1) % index->max_objects) {
+        if (index->objects[i].object == object + 1) {
+            return &index->objects[i];
+        }
+    }
 
-    if (jc_is_expected(state, JC_TOKEN_TYPE_NUMBER)
-            && strchr(JC_VALID_CHARS_IN_NUMBER, current_char) != NULL) {
-        return jc_parse_number(state, token);
+    /* Keep the table at most three quarters full, so probes stay short */
+    if ((index->num_objects + 1) * 4 > index->max_objects * 3) {
+        return NULL;
     }
 
-    /* Parse literals */
+    ++(index->num_objects);
+    index->objects[i].object = object + 1;
+    return &index->objects[i];
+}
 
-    if (jc_is_expected(state, JC_TOKEN_TYPE_TRUE)
-            && strchr(JC_LIT_TRUE, current_char) != NULL) {
-        return jc_parse_literal(state, token, JC_TOKEN_TYPE_TRUE, JC_LIT_TRUE);
+jc_result jc_tape_find_member(jc_tape_index * index, size_t object,
+                              char const * key, size_t key_len, size_t * value)
+{
+    jc_tape_object * record = NULL;
+    jc_tape_slot const * slot = NULL;
+    size_t pos = 0;
+
+    if (object >= index->num_tokens
+            || index->tokens[object].type != JC_TOKEN_TYPE_OBJECT_START) {
+        return JC_RESULT_ERR_UNEXPECTED_TOKEN;
     }
 
-    if (jc_is_expected(state, JC_TOKEN_TYPE_FALSE)
-            && strchr(JC_LIT_FALSE, current_char) != NULL) {
-        return jc_parse_literal(state, token, JC_TOKEN_TYPE_FALSE, JC_LIT_FALSE);
+    record = jc_tape_find_object(index, object);
+    if (record != NULL && record->status == JC_TAPE_OBJECT_PENDING
+            && ++(record->num_lookups) > index->threshold) {
+        jc_tape_build_index(index, record);
     }
 
-    if (jc_is_expected(state, JC_TOKEN_TYPE_NULL)
-            && strchr(JC_LIT_NULL, current_char) != NULL) {
-        return jc_parse_literal(state, token, JC_TOKEN_TYPE_NULL, JC_LIT_NULL);
+    if (record != NULL && record->status == JC_TAPE_OBJECT_INDEXED) {
+        slot = jc_tape_probe(index, record,
+                             jc_hash(JC_HASH_INIT, key, key_len), key, key_len);
+        if (slot->member == 0) {
+            return JC_RESULT_EOF;
+        }
+
+        *value = slot->member + 1;
+        return JC_RESULT_OK;
     }
 
-    return JC_RESULT_ERR_UNEXPECTED_TOKEN;
+    for (pos = object + 1; jc_tape_next_member(index, pos, &pos);
+            pos = jc_tape_skip_value(index, pos + 2)) {
+        if (index->tokens[pos].type == JC_TOKEN_TYPE_OBJECT_END) {
+            return JC_RESULT_EOF;
+        } else if (jc_tape_key_equals(index, pos, key, key_len)) {
+            *value = pos + 2;
+            return JC_RESULT_OK;
+        }
+    }
+
+    return JC_RESULT_ERR_CORRUPTED_STATE;
 }
 
 #ifdef __cplusplus
@@ -1,29 +1,712 @@
+/* The test program is also built without path tracking, see Makefile */
+#ifndef TEST_WITHOUT_PATH_TRACKING
+#define JC_PATH_TRACKING
+#endif
 #include "jc.h"
 #include <stdlib.h>
 #include <stdio.h>
 
 #define MAX_TEST_FILE_SIZE 4096
 #define MAX_TOKEN_CONTENTS_SIZE 256
+#define MAX_BATCH_DOCUMENTS 32
+#define MAX_BATCH_TOKENS 64
+#define MAX_CACHED_TOKENS 64
+#define MAX_LAST_ELEMENTS 32
+#define MAX_SAMPLED_RECORDS 32
+#define CACHE_SHARDS 2
+#define CACHE_SLOT_SIZE 512
+#define CACHE_ARENA_SIZE (CACHE_SHARDS * JC_CACHE_WAYS * CACHE_SLOT_SIZE)
+#define MAX_READ_SIZE 5
+#define MAX_SEGMENTS 256
+#define MAX_TOKEN_PARTS 16
+#define MAX_PATH_SIZE 256
+#define MAX_INDEX_CHECKPOINTS 64
+#define MAX_INDEX_DELTAS 256
+#define MAX_DECODED_SIZE 16
+#define DICT_ARENA_WORDS 32
+#define MAX_PACKED_TOKENS 256
+#define PACKED_BATCH_SIZE 3
+#define MAX_TAPE_TOKENS 256
+#define MAX_TAPE_OBJECTS 8
+#define MAX_TAPE_SLOTS 16
+#define TAPE_MIN_MEMBERS 3
+#define TAPE_LOOKUP_PASSES 3
+
+/*
+ * Options:
+ *  -n  tokenize contents of every string token as a nested JSON document
+ *  -b  tokenize every line of the case file as a document of a batch
+ *  -C  tokenize every line of the case file through a parse cache
+ *  -d <depth>  skip tokens deeper than <depth>
+ *  -p  peek every token before fetching it
+ *  -c  count remaining elements after every object start, array start and
+ *      comma token
+ *  -r  count records of the case file as NDJSON and print their boundaries
+ *  -t <n>  find last <n> elements of the array in the case file backwards
+ *      and tokenize each of them
+ *  -o <offset>  start tokenizing at <offset>, guessing whether it's inside of
+ *      a string
+ *  -s <k>  tokenize every <k>th NDJSON record of the case file
+ *  -f <percent>  tokenize a random <percent> of NDJSON records of the case
+ *      file, using a fixed seed
+ *  -R <k>  print a reservoir sample of <k> NDJSON records of the case file,
+ *      using a fixed seed
+ *  -w <size>  pull the case file through a window of <size> characters,
+ *      reading at most MAX_READ_SIZE characters at once
+ *  -v <size>  split the case file into segments of <size> characters and
+ *      tokenize them without joining
+ *  -T  tokenize in trusted input mode
+ *  -P  print the JSON Pointer of every token and check its path hash, unless
+ *      built with TEST_WITHOUT_PATH_TRACKING
+ *  -I <interval>  build a record index of the case file as NDJSON with
+ *      a checkpoint every <interval> records, starting with buffers that are
+ *      too small and growing them, and print every record found through it
+ *  -D  decode every number token as an integer and every string and field name
+ *      token into a buffer of MAX_DECODED_SIZE characters
+ *  -S  skip the rest of the enclosing object or array after every string token
+ *  -F <size>  flatten every document of the case file into paths and values,
+ *      keeping paths in a buffer of <size> characters
+ *  -k <n>  encode every string token with a dictionary of at most <n> entries
+ *      in an arena of DICT_ARENA_WORDS words, and print the dictionary at the
+ *      end
+ *  -z <interval>  pack all tokens into a packed tape with a checkpoint every
+ *      <interval> tokens, print them read back in batches of PACKED_BATCH_SIZE,
+ *      and check that seeking to every token backwards finds the same token
+ *  -x <threshold>  look up every member and a missing one in every object of
+ *      the token tape of the case file TAPE_LOOKUP_PASSES times, building
+ *      member indexes for objects looked up more than <threshold> times
+ */
+typedef struct {
+    int nested;
+    int batch;
+    int cache;
+    int max_emit_depth;
+    int peek;
+    int count;
+    int records;
+    size_t tail;
+    size_t offset;
+    size_t every_kth;
+    int percent;
+    size_t reservoir;
+    size_t window_size;
+    size_t segment_size;
+    int trusted;
+    int path;
+    size_t index_interval;
+    int decode;
+    int skip;
+    size_t flatten_size;
+    size_t dict_entries;
+    size_t packed_interval;
+    int lookup_threshold;
+} test_options;
+
+/*
+ * Source of a reader state: the case file contents
+ */
+typedef struct {
+    char const * src;
+    size_t len;
+    size_t pos;
+} test_reader;
+
+void print_usage()
+{
+    printf("Usage: ./test [-n] [-b] [-C] [-d <depth>] [-p] [-c] [-r] [-t <n>] [-o <offset>] [-s <k>] [-f <percent>] [-R <k>] [-w <size>] [-v <size>] [-T] [-P] [-I <interval>] [-D] [-S] [-F <size>] [-k <n>] [-z <interval>] [-x <threshold>] <case-file-path>\n");
+}
+
+void print_token(char const * data, jc_token const * token, char const * indent)
+{
+    size_t token_len = 0;
+    size_t token_buf_len = 0;
+    char token_buf[MAX_TOKEN_CONTENTS_SIZE] = "";
+
+    token_len = token->end - token->start;
+    token_buf_len = token_len > sizeof(token_buf) - 1
+                  ? sizeof(token_buf) - 1
+                  : token_len;
+    strncpy(token_buf, data, token_buf_len);
+    token_buf[token_buf_len] = '\0';
+
+    printf("%sT 0x%03X @ (%03ld, %03ld) [ %s ]\n", indent, token->type,
+            token->start, token->end, token_buf);
+}
+
+/*
+ * Prints a token fetched from the state, joining its contents if they are
+ * split into many parts
+ */
+void print_fetched_token(jc_state const * jc, jc_token const * token,
+                         char const * indent)
+{
+    jc_segment parts[MAX_TOKEN_PARTS];
+    char data[MAX_TOKEN_CONTENTS_SIZE] = { 0 };
+    size_t num_parts = 0;
+    size_t len = 0;
+    size_t part_len = 0;
+    size_t i = 0;
+
+    num_parts = jc_token_parts(jc, token, parts, MAX_TOKEN_PARTS);
+    for (i = 0; i < num_parts && len < sizeof(data); ++i) {
+        part_len = parts[i].len > sizeof(data) - len
+                 ? sizeof(data) - len
+                 : parts[i].len;
+        memcpy(data + len, parts[i].data, part_len);
+        len += part_len;
+    }
+
+    print_token(data, token, indent);
+    if (num_parts > 1) {
+        printf("%s  %ld parts\n", indent, num_parts);
+    }
+}
+
+#ifdef JC_PATH_TRACKING
+void print_path(jc_state * jc)
+{
+    char path[MAX_PATH_SIZE];
+    jc_result result = jc_current_path(jc, path, sizeof(path));
+
+    if (result != JC_RESULT_OK) {
+        printf("  E 0x%03X\n", result);
+        return;
+    }
+
+    printf("  \"%s\"\n", path);
+    if (jc_pointer_hash(path) != jc_path_hash(jc)) {
+        printf("Path hash differs\n");
+    }
+}
+#endif
+
+void print_decoded(jc_state const * jc, jc_token const * token)
+{
+    char buffer[MAX_DECODED_SIZE];
+    char const * data = jc_token_data(jc, token);
+    size_t len = 0;
+    long value = 0;
+    jc_result result;
+
+    if (token->type == JC_TOKEN_TYPE_NUMBER) {
+        result = jc_decode_integer(data, token->end - token->start, &value);
+        if (result == JC_RESULT_OK) {
+            printf("  I %ld\n", value);
+        } else {
+            printf("  I E 0x%03X\n", result);
+        }
+    } else if (token->type & (JC_TOKEN_TYPE_STRING
+                              | JC_TOKEN_TYPE_FIELD_NAME)) {
+        result = jc_decode_string(data, token->end - token->start, buffer,
+                                  sizeof(buffer), &len);
+        printf("  S %02ld [ %s ]", len, buffer);
+        if (result != JC_RESULT_OK) {
+            printf(" E 0x%03X", result);
+        }
+        printf("\n");
+    }
+}
+
+size_t read_test_source(void * ctx, char * buffer, size_t size)
+{
+    test_reader * reader = ctx;
+    size_t num_read = reader->len - reader->pos;
+
+    num_read = num_read > size ? size : num_read;
+    num_read = num_read > MAX_READ_SIZE ? MAX_READ_SIZE : num_read;
+    memcpy(buffer, reader->src + reader->pos, num_read);
+    reader->pos += num_read;
+    return num_read;
+}
+
+void print_nested_tokens(char const * src, jc_token const * string_token)
+{
+    jc_state jc;
+    jc_token token;
+    jc_result result;
+
+    jc_init_nested(&jc, src, string_token);
+    while ((result = jc_next_token(&jc, &token)) != JC_RESULT_EOF) {
+        if (result != JC_RESULT_OK) {
+            printf("  E 0x%03X\n", result);
+            break;
+        }
+        print_fetched_token(&jc, &token, "  ");
+    }
+}
+
+void print_batch_tokens(char const * src)
+{
+    jc_document documents[MAX_BATCH_DOCUMENTS];
+    jc_document_tokens ranges[MAX_BATCH_DOCUMENTS];
+    jc_token tokens[MAX_BATCH_TOKENS];
+    char const * line_end = NULL;
+    size_t num_documents = 0;
+    size_t num_processed = 0;
+    size_t i = 0;
+    size_t j = 0;
+
+    while (*src != '\0' && num_documents < MAX_BATCH_DOCUMENTS) {
+        line_end = strchr(src, '\n');
+        if (line_end == NULL) {
+            line_end = src + strlen(src);
+        }
+
+        documents[num_documents].source = src;
+        documents[num_documents].len = line_end - src;
+        ++num_documents;
+        src = (*line_end == '\0') ? line_end : line_end + 1;
+    }
+
+    num_processed = jc_tokenize_batch(documents, num_documents, tokens,
+                                      MAX_BATCH_TOKENS, ranges);
+    for (i = 0; i < num_processed; ++i) {
+        printf("D %02ld: %02ld + %02ld, R 0x%03X\n", i, ranges[i].first_token,
+                ranges[i].num_tokens, ranges[i].result);
+        for (j = 0; j < ranges[i].num_tokens; ++j) {
+            print_token(documents[i].source
+                            + tokens[ranges[i].first_token + j].start,
+                        &tokens[ranges[i].first_token + j], "  ");
+        }
+    }
+}
+
+void print_cached_tokens(char const * src)
+{
+    jc_cache cache;
+    jc_cache_shard shards[CACHE_SHARDS];
+    jc_token arena[CACHE_ARENA_SIZE / sizeof(jc_token)];
+    jc_token tokens[MAX_CACHED_TOKENS];
+    jc_result result;
+    char const * line_end = NULL;
+    size_t num_tokens = 0;
+    unsigned long hits = 0;
+    unsigned long misses = 0;
+    unsigned long prev_hits = 0;
+    size_t i = 0;
+
+    jc_cache_init(&cache, shards, CACHE_SHARDS, arena, sizeof(arena),
+                  CACHE_SLOT_SIZE);
+    for (i = 0; *src != '\0'; ++i) {
+        line_end = strchr(src, '\n');
+        if (line_end == NULL) {
+            line_end = src + strlen(src);
+        }
+
+        result = jc_cache_tokenize(&cache, src, line_end - src, tokens,
+                                   MAX_CACHED_TOKENS, &num_tokens);
+        jc_cache_stats(&cache, &hits, &misses);
+        printf("D %02ld: %s %02ld tokens, R 0x%03X\n", i,
+                hits > prev_hits ? "hit " : "miss", num_tokens, result);
+        prev_hits = hits;
+        src = (*line_end == '\0') ? line_end : line_end + 1;
+    }
+
+    printf("S %lu hits, %lu misses\n", hits, misses);
+}
+
+int print_flattened_value(void * ctx, char const * path, size_t path_len,
+                          jc_token const * value)
+{
+    char prefix[MAX_PATH_SIZE + 16];
+
+    sprintf(prefix, "F %s (%ld) = ", path, path_len);
+    print_fetched_token((jc_state const *) ctx, value, prefix);
+    return 1;
+}
+
+void print_flattened(jc_state * jc, size_t path_size)
+{
+    char path[MAX_PATH_SIZE];
+    jc_result result;
+
+    path_size = path_size > sizeof(path) ? sizeof(path) : path_size;
+    while ((result = jc_flatten(jc, path, path_size, print_flattened_value,
+                                jc)) == JC_RESULT_OK) {
+        printf("F done\n");
+    }
+
+    if (result != JC_RESULT_EOF) {
+        printf("F E 0x%03X\n", result);
+    }
+}
+
+void print_dict(jc_dict const * dict)
+{
+    jc_token token;
+    char const * data = NULL;
+    size_t code = 0;
+
+    printf("K %ld entries, %ld of %ld string bytes\n", dict->num_entries,
+            dict->strings_len, dict->strings_size);
+    for (code = 0; jc_dict_decode(dict, code, &data, &token.end)
+            == JC_RESULT_OK; ++code) {
+        token.type = JC_TOKEN_TYPE_STRING;
+        token.start = 0;
+        print_token(data, &token, "  ");
+    }
+}
+
+void print_packed_tokens(char const * src, size_t interval)
+{
+    static unsigned char types[MAX_PACKED_TOKENS / 2];
+    static unsigned char data[MAX_PACKED_TOKENS * 2 * JC_MAX_VARINT_SIZE];
+    static jc_packed_checkpoint checkpoints[MAX_PACKED_TOKENS];
+    static jc_token tokens[MAX_PACKED_TOKENS];
+    jc_packed_tape tape;
+    jc_packed_reader reader;
+    jc_state jc;
+    jc_token token;
+    jc_result result;
+    size_t num_tokens = 0;
+    size_t num_read = 0;
+    size_t i = 0;
+
+    jc_packed_tape_init(&tape, types, sizeof(types), data, sizeof(data),
+                        checkpoints, MAX_PACKED_TOKENS, interval);
+    jc_init(&jc, src);
+    while ((result = jc_next_token(&jc, &token)) == JC_RESULT_OK) {
+        result = jc_packed_tape_add(&tape, &token);
+        if (result != JC_RESULT_OK) {
+            break;
+        }
+    }
+
+    printf("Z %ld tokens, %ld data bytes, %ld checkpoints, R 0x%03X\n",
+            tape.num_tokens, tape.data_len, tape.num_checkpoints, result);
+
+    jc_packed_tape_seek(&tape, 0, &reader);
+    while ((result = jc_packed_tape_read(&reader, tokens + num_tokens,
+                                         PACKED_BATCH_SIZE, &num_read))
+            == JC_RESULT_OK) {
+        printf("B %ld\n", num_read);
+        for (i = num_tokens; i < num_tokens + num_read; ++i) {
+            print_token(src + tokens[i].start, &tokens[i], "  ");
+        }
+        num_tokens += num_read;
+    }
+    if (result != JC_RESULT_EOF) {
+        printf("E 0x%03X\n", result);
+    }
+
+    for (i = num_tokens; i-- > 0; ) {
+        result = jc_packed_tape_seek(&tape, i, &reader);
+        if (result == JC_RESULT_OK) {
+            result = jc_packed_tape_read(&reader, &token, 1, &num_read);
+        }
+        if (result != JC_RESULT_OK || token.type != tokens[i].type
+                || token.start != tokens[i].start
+                || token.end != tokens[i].end) {
+            printf("Seek to %ld differs\n", i);
+        }
+    }
+}
+
+/*
+ * Looks up every member of the object at tape position `object` and a missing
+ * one, and prints the number of members and how they were looked up
+ */
+void print_object_lookups(jc_tape_index * index, size_t object)
+{
+    jc_token const * tokens = index->tokens;
+    jc_tape_object const * record = NULL;
+    jc_result result;
+    size_t value = 0;
+    size_t num_members = 0;
+    size_t depth = 0;
+    size_t i = object;
+    size_t j = 0;
+
+    do {
+        if (tokens[i].type & (JC_TOKEN_TYPE_OBJECT_START
+                              | JC_TOKEN_TYPE_ARRAY_START)) {
+            ++depth;
+        } else if (tokens[i].type & (JC_TOKEN_TYPE_OBJECT_END
+                                     | JC_TOKEN_TYPE_ARRAY_END)) {
+            --depth;
+        } else if (depth == 1 && tokens[i].type == JC_TOKEN_TYPE_FIELD_NAME) {
+            ++num_members;
+            result = jc_tape_find_member(index, object,
+                                         index->source + tokens[i].start,
+                                         tokens[i].end - tokens[i].start,
+                                         &value);
+            if (result != JC_RESULT_OK || value != i + 2) {
+                printf("  Member @ %03ld differs, R 0x%03X\n", i, result);
+            }
+        }
+    } while (depth > 0 && ++i < index->num_tokens);
+
+    result = jc_tape_find_member(index, object, "?", 1, &value);
+    if (result != JC_RESULT_EOF) {
+        printf("  Missing member found, R 0x%03X\n", result);
+    }
+
+    for (j = 0; j < index->max_objects; ++j) {
+        if (index->objects[j].object == object + 1) {
+            record = &index->objects[j];
+        }
+    }
+
+    if (record == NULL) {
+        printf("  @ %03ld: %ld members, untracked\n", object, num_members);
+    } else {
+        printf("  @ %03ld: %ld members, %ld lookups, status %d, %ld slots\n",
+                object, num_members, record->num_lookups, record->status,
+                record->num_slots);
+    }
+}
+
+void print_member_lookups(char const * src, unsigned long threshold)
+{
+    static jc_token tokens[MAX_TAPE_TOKENS];
+    jc_tape_object objects[MAX_TAPE_OBJECTS];
+    jc_tape_slot slots[MAX_TAPE_SLOTS];
+    jc_tape_index index;
+    jc_state jc;
+    jc_result result;
+    size_t num_tokens = 0;
+    size_t value = 0;
+    size_t pass = 0;
+    size_t i = 0;
+
+    jc_init(&jc, src);
+    result = jc_tokenize(&jc, tokens, MAX_TAPE_TOKENS, &num_tokens);
+    if (result != JC_RESULT_OK) {
+        printf("E 0x%03X\n", result);
+        return;
+    }
+
+    jc_tape_index_init(&index, src, tokens, num_tokens, objects,
+                       MAX_TAPE_OBJECTS, slots, MAX_TAPE_SLOTS,
+                       TAPE_MIN_MEMBERS, threshold);
+    printf("X %ld tokens, R 0x%03X\n", num_tokens,
+            jc_tape_find_member(&index, num_tokens, "?", 1, &value));
+
+    for (pass = 0; pass < TAPE_LOOKUP_PASSES; ++pass) {
+        printf("X pass %ld\n", pass);
+        for (i = 0; i < num_tokens; ++i) {
+            if (tokens[i].type == JC_TOKEN_TYPE_OBJECT_START) {
+                print_object_lookups(&index, i);
+            }
+        }
+        printf("  %ld objects, %ld slots\n", index.num_objects,
+                index.num_slots);
+    }
+}
+
+void print_records(char const * src, size_t src_size)
+{
+    size_t pos = 0;
+    size_t end = 0;
+
+    printf("R %ld records\n", jc_count_records(src, src_size));
+    for (pos = 0; pos < src_size; pos = end + 1) {
+        end = jc_find_record_end(src, src_size, pos);
+        printf("  @ (%03ld, %03ld)\n", pos, end);
+    }
+}
+
+void print_indexed_records(char const * src, size_t src_size,
+                           size_t interval)
+{
+    jc_record_checkpoint checkpoints[MAX_INDEX_CHECKPOINTS];
+    unsigned char deltas[MAX_INDEX_DELTAS];
+    jc_record_index index;
+    jc_result result;
+    size_t num_builds = 1;
+    size_t offset = 0;
+    size_t i = 0;
+
+    jc_record_index_init(&index, checkpoints, 1, deltas, 1, interval);
+    while ((result = jc_record_index_build(&index, src, src_size))
+            == JC_RESULT_ERR_BUFFER_FULL) {
+        if (index.max_checkpoints == MAX_INDEX_CHECKPOINTS
+                && index.deltas_size == MAX_INDEX_DELTAS) {
+            break;
+        }
+
+        index.max_checkpoints *= 2;
+        index.max_checkpoints = index.max_checkpoints > MAX_INDEX_CHECKPOINTS
+                              ? MAX_INDEX_CHECKPOINTS
+                              : index.max_checkpoints;
+        index.deltas_size *= 2;
+        index.deltas_size = index.deltas_size > MAX_INDEX_DELTAS
+                          ? MAX_INDEX_DELTAS
+                          : index.deltas_size;
+        ++num_builds;
+    }
+
+    printf("I %ld records, %ld checkpoints, %ld delta bytes, %ld builds, "
+            "R 0x%03X\n", index.num_records, index.num_checkpoints,
+            index.deltas_len, num_builds, result);
+    for (i = 0; jc_record_index_get(&index, i, &offset) == JC_RESULT_OK; ++i) {
+        printf("  %02ld @ (%03ld, %03ld)\n", i, offset,
+                jc_find_record_end(src, src_size, offset));
+    }
+}
+
+void print_tail_elements(char const * src, size_t src_size, size_t n)
+{
+    jc_state jc;
+    jc_token elements[MAX_LAST_ELEMENTS];
+    jc_token token;
+    jc_result result;
+    size_t num_elements = 0;
+    size_t i = 0;
+
+    n = n > MAX_LAST_ELEMENTS ? MAX_LAST_ELEMENTS : n;
+    result = jc_find_last_elements(src, src_size, elements, n, &num_elements);
+    printf("L %ld elements, R 0x%03X\n", num_elements, result);
+
+    for (i = 0; i < num_elements; ++i) {
+        print_token(src + elements[i].start, &elements[i], "");
+        jc_init_span(&jc, src, elements[i].start, elements[i].end);
+        while ((result = jc_next_token(&jc, &token)) != JC_RESULT_EOF) {
+            if (result != JC_RESULT_OK) {
+                printf("  E 0x%03X\n", result);
+                break;
+            }
+            print_fetched_token(&jc, &token, "  ");
+        }
+    }
+}
+
+void print_sampled_records(jc_sampler * sampler)
+{
+    jc_state jc;
+    jc_token token;
+    jc_result result;
+    size_t record_index = 0;
+
+    while (jc_sampler_next(sampler, &jc, &record_index) == JC_RESULT_OK) {
+        printf("S %02ld\n", record_index);
+        while ((result = jc_next_token(&jc, &token)) != JC_RESULT_EOF) {
+            if (result != JC_RESULT_OK) {
+                printf("  E 0x%03X\n", result);
+                break;
+            }
+            print_fetched_token(&jc, &token, "  ");
+        }
+    }
+}
+
+void print_samples(char const * src, size_t src_size,
+                   test_options const * options)
+{
+    jc_sampler sampler;
+    jc_token records[MAX_SAMPLED_RECORDS];
+    size_t num_records = 0;
+    size_t i = 0;
+
+    if (options->every_kth > 0) {
+        printf("Every %ld\n", options->every_kth);
+        jc_sampler_init_every(&sampler, src, src_size, options->every_kth);
+        print_sampled_records(&sampler);
+    }
+
+    if (options->percent >= 0) {
+        printf("Fraction %d%%\n", options->percent);
+        jc_sampler_init_fraction(&sampler, src, src_size,
+                                 options->percent / 100.0, 1);
+        print_sampled_records(&sampler);
+    }
+
+    if (options->reservoir > 0) {
+        num_records = jc_sample_reservoir(src, src_size,
+            options->reservoir > MAX_SAMPLED_RECORDS
+                ? MAX_SAMPLED_RECORDS
+                : options->reservoir,
+            1, records);
+        printf("Reservoir %ld\n", num_records);
+        for (i = 0; i < num_records; ++i) {
+            print_token(src + records[i].start, &records[i], "");
+        }
+    }
+}
 
 int main(int argc, char const * argv[])
 {
     jc_state jc;
     jc_token token;
     jc_result result;
-    size_t token_len = 0;
-    size_t token_buf_len = 0;
-    char token_buf[MAX_TOKEN_CONTENTS_SIZE] = "";
+    test_options options = { 0, 0, 0, -1, 0, 0, 0, 0, 0, 0, -1, 0, 0, 0, 0, 0, 0,
+                             0, 0, 0, 0, 0, -1 };
+    size_t count = 0;
+    jc_token peeked_token;
+    jc_result peeked_result;
+    int arg = 1;
     FILE * src_file = NULL;
     size_t src_size = 0;
     char src[MAX_TEST_FILE_SIZE] = "";
+    char window[MAX_TEST_FILE_SIZE];
+    test_reader reader;
+    jc_segment segments[MAX_SEGMENTS];
+    size_t num_segments = 0;
+    jc_dict dict;
+    size_t dict_arena[DICT_ARENA_WORDS];
+
+    for (; arg < argc - 1; ++arg) {
+        if (strcmp(argv[arg], "-n") == 0) {
+            options.nested = 1;
+        } else if (strcmp(argv[arg], "-b") == 0) {
+            options.batch = 1;
+        } else if (strcmp(argv[arg], "-C") == 0) {
+            options.cache = 1;
+        } else if (strcmp(argv[arg], "-d") == 0 && arg < argc - 2) {
+            options.max_emit_depth = atoi(argv[++arg]);
+        } else if (strcmp(argv[arg], "-p") == 0) {
+            options.peek = 1;
+        } else if (strcmp(argv[arg], "-c") == 0) {
+            options.count = 1;
+        } else if (strcmp(argv[arg], "-r") == 0) {
+            options.records = 1;
+        } else if (strcmp(argv[arg], "-t") == 0 && arg < argc - 2) {
+            options.tail = atoi(argv[++arg]);
+        } else if (strcmp(argv[arg], "-o") == 0 && arg < argc - 2) {
+            options.offset = atoi(argv[++arg]);
+        } else if (strcmp(argv[arg], "-s") == 0 && arg < argc - 2) {
+            options.every_kth = atoi(argv[++arg]);
+        } else if (strcmp(argv[arg], "-f") == 0 && arg < argc - 2) {
+            options.percent = atoi(argv[++arg]);
+        } else if (strcmp(argv[arg], "-R") == 0 && arg < argc - 2) {
+            options.reservoir = atoi(argv[++arg]);
+        } else if (strcmp(argv[arg], "-w") == 0 && arg < argc - 2) {
+            options.window_size = atoi(argv[++arg]);
+        } else if (strcmp(argv[arg], "-v") == 0 && arg < argc - 2) {
+            options.segment_size = atoi(argv[++arg]);
+        } else if (strcmp(argv[arg], "-T") == 0) {
+            options.trusted = 1;
+#ifdef JC_PATH_TRACKING
+        } else if (strcmp(argv[arg], "-P") == 0) {
+            options.path = 1;
+#endif
+        } else if (strcmp(argv[arg], "-I") == 0 && arg < argc - 2) {
+            options.index_interval = atoi(argv[++arg]);
+        } else if (strcmp(argv[arg], "-D") == 0) {
+            options.decode = 1;
+        } else if (strcmp(argv[arg], "-S") == 0) {
+            options.skip = 1;
+        } else if (strcmp(argv[arg], "-F") == 0 && arg < argc - 2) {
+            options.flatten_size = atoi(argv[++arg]);
+        } else if (strcmp(argv[arg], "-k") == 0 && arg < argc - 2) {
+            options.dict_entries = atoi(argv[++arg]);
+        } else if (strcmp(argv[arg], "-z") == 0 && arg < argc - 2) {
+            options.packed_interval = atoi(argv[++arg]);
+        } else if (strcmp(argv[arg], "-x") == 0 && arg < argc - 2) {
+            options.lookup_threshold = atoi(argv[++arg]);
+        } else {
+            print_usage();
+            abort();
+        }
+    }
 
-    if (argc < 2) {
-        printf("Usage: ./test <case-file-path>\n");
+    if (arg != argc - 1) {
+        print_usage();
         abort();
     }
 
-    src_file = fopen(argv[1], "rb");
-    src_size = fread(src, sizeof(*src), MAX_TEST_FILE_SIZE, src_file);
+    src_file = fopen(argv[arg], "rb");
+    src_size = fread(src, sizeof(*src), MAX_TEST_FILE_SIZE - 1, src_file);
 
     if (ferror(src_file)) {
         perror("Error while reading test case file");
@@ -33,23 +716,166 @@ int main(int argc, char const * argv[])
     fclose(src_file);
     src[src_size] = '\0';
 
-    jc_init(&jc, src);
-    while ((result = jc_next_token(&jc, &token)) != JC_RESULT_EOF) {
+    if (options.batch) {
+        print_batch_tokens(src);
+        return 0;
+    }
+
+    if (options.records) {
+        print_records(src, src_size);
+        return 0;
+    }
+
+    if (options.index_interval > 0) {
+        print_indexed_records(src, src_size, options.index_interval);
+        return 0;
+    }
+
+    if (options.every_kth > 0 || options.percent >= 0
+            || options.reservoir > 0) {
+        print_samples(src, src_size, &options);
+        return 0;
+    }
+
+    if (options.tail > 0) {
+        print_tail_elements(src, src_size, options.tail);
+        return 0;
+    }
+
+    if (options.cache) {
+        print_cached_tokens(src);
+        return 0;
+    }
+
+    if (options.packed_interval > 0) {
+        print_packed_tokens(src, options.packed_interval);
+        return 0;
+    }
+
+    if (options.lookup_threshold >= 0) {
+        print_member_lookups(src, options.lookup_threshold);
+        return 0;
+    }
+
+    if (options.offset > 0) {
+        result = jc_init_at(&jc, src, src_size, options.offset,
+                            JC_OFFSET_HINT_NONE);
+        if (result != JC_RESULT_OK) {
+            printf("E 0x%03X\n", result);
+            return 0;
+        }
+    } else if (options.window_size > 0) {
+        reader.src = src;
+        reader.len = src_size;
+        reader.pos = 0;
+        result = jc_init_reader(&jc, window,
+            options.window_size > sizeof(window)
+                ? sizeof(window)
+                : options.window_size,
+            read_test_source, &reader);
+        if (result != JC_RESULT_OK) {
+            printf("E 0x%03X\n", result);
+            return 0;
+        }
+    } else if (options.segment_size > 0) {
+        for (count = 0; count < src_size && num_segments < MAX_SEGMENTS;
+                count += options.segment_size) {
+            segments[num_segments].data = src + count;
+            segments[num_segments].len = src_size - count;
+            if (segments[num_segments].len > options.segment_size) {
+                segments[num_segments].len = options.segment_size;
+            }
+            ++num_segments;
+        }
+        jc_init_iov(&jc, segments, num_segments);
+    } else {
+        jc_init(&jc, src);
+    }
+    jc_set_max_emit_depth(&jc, options.max_emit_depth);
+    if (options.trusted) {
+        jc_set_trusted_input(&jc, 1);
+    }
+    if (options.flatten_size > 0) {
+        print_flattened(&jc, options.flatten_size);
+        return 0;
+    }
+    if (options.dict_entries > 0) {
+        result = jc_dict_init(&dict, dict_arena, sizeof(dict_arena),
+                              options.dict_entries);
         if (result != JC_RESULT_OK) {
+            printf("K E 0x%03X\n", result);
+            return 0;
+        }
+    }
+    for (;;) {
+        if (options.peek) {
+            peeked_result = jc_peek_token(&jc, &peeked_token);
+            if (peeked_result == JC_RESULT_OK) {
+                print_fetched_token(&jc, &peeked_token, "P ");
+            } else {
+                printf("P E 0x%03X\n", peeked_result);
+            }
+        }
+
+        result = jc_next_token(&jc, &token);
+        if (options.peek && (result != peeked_result
+                || (result == JC_RESULT_OK
+                    && (token.type != peeked_token.type
+                        || token.start != peeked_token.start
+                        || token.end != peeked_token.end)))) {
+            printf("Peeked token differs\n");
+        }
+
+        if (result == JC_RESULT_EOF) {
+            break;
+        } else if (result != JC_RESULT_OK) {
             printf("E 0x%03X\n", result);
             break;
         }
 
-        memset(token_buf, 0, sizeof(token_buf));
-        token_len = token.end - token.start;
-        token_buf_len = token_len > sizeof(token_buf) - 1
-                      ? sizeof(token_buf) - 1
-                      : token_len;
-        strncpy(token_buf, src + token.start, token_buf_len);
-        token_buf[token_buf_len + 1] = '\0';
+        print_fetched_token(&jc, &token, "");
+#ifdef JC_PATH_TRACKING
+        if (options.path) {
+            print_path(&jc);
+        }
+#endif
+        if (options.decode) {
+            print_decoded(&jc, &token);
+        }
+        if (options.count && (token.type & (JC_TOKEN_TYPE_OBJECT_START
+                | JC_TOKEN_TYPE_ARRAY_START | JC_TOKEN_TYPE_COMMA))) {
+            result = jc_count_elements(&jc, &count);
+            if (result == JC_RESULT_OK) {
+                printf("C %ld\n", count);
+            } else {
+                printf("C E 0x%03X\n", result);
+            }
+        }
+
+        if (options.nested && token.type == JC_TOKEN_TYPE_STRING) {
+            print_nested_tokens(src, &token);
+        }
+
+        if (options.skip && token.type == JC_TOKEN_TYPE_STRING) {
+            result = jc_skip_container(&jc);
+            if (result != JC_RESULT_OK) {
+                printf("S E 0x%03X\n", result);
+            }
+        }
+
+        if (options.dict_entries > 0 && token.type == JC_TOKEN_TYPE_STRING) {
+            result = jc_dict_encode(&dict, jc_token_data(&jc, &token),
+                                    token.end - token.start, &count);
+            if (result == JC_RESULT_OK) {
+                printf("K %ld\n", count);
+            } else {
+                printf("K E 0x%03X\n", result);
+            }
+        }
+    }
 
-        printf("T 0x%03X @ (%03ld, %03ld) [ %s ]\n", token.type, token.start,
-                token.end, token_buf);
+    if (options.dict_entries > 0) {
+        print_dict(&dict);
     }
 
     return 0;